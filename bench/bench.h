@@ -0,0 +1,38 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+// Small helpers shared by the host benchmarks
+
+namespace bench {
+  inline uint64_t nsec() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000u + ts.tv_nsec;
+  }
+
+  /**
+   * @brief measures the wall time of a block of code
+   *
+   * @code
+   * bench::Stopwatch sw;
+   * for (...) work();
+   * printf("%.1f ns/op\n", sw.ns_per(iterations));
+   * @endcode
+   */
+  class Stopwatch {
+    uint64_t start;
+
+  public:
+    Stopwatch() : start(nsec()) {}
+    void reset() { start = nsec(); }
+    uint64_t elapsed() const { return nsec() - start; }
+    double ns_per(uint64_t count) const { return (double) elapsed() / count; }
+  };
+
+  inline void report(const char *what, double value, const char *unit) {
+    printf("  %-40s %10.1f %s\n", what, value, unit);
+  }
+}
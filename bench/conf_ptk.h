@@ -0,0 +1,4 @@
+#pragma once
+
+// libptk configuration used by the host benchmarks
+#define PTK_PORT_LINUX
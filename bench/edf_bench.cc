@@ -0,0 +1,137 @@
+/*
+ * Deadline misses of FIFO and EDF ordering, simulated on a tick clock.
+ *
+ * A set of periodic protothreads, each with its deadline at the end of its
+ * period, runs on a simulated CPU. Each job takes a fixed number of ticks,
+ * and the clock only moves while a job runs or nothing is ready, so the
+ * results don't depend on the host. Protothreads can't be preempted, so a
+ * long job blocks every other thread while it runs.
+ *
+ * Both policies run on the same PTK_EDF build. In FIFO mode the threads
+ * simply never declare a deadline, which leaves the ready heap in FIFO
+ * order. The task set is scaled to a range of loads, from comfortably
+ * schedulable to overloaded.
+ *
+ * Expect EDF to miss far fewer deadlines up to full load, and far more past
+ * it. Once the CPU is overloaded, EDF keeps running whichever job is
+ * already late, so nearly every job ends up late (the domino effect).
+ * Systems that can be overloaded need admission control or priorities on
+ * top of the deadlines.
+ */
+#include "bench.h"
+#include "ptk/ptk.h"
+#include "ptk/port.h"
+
+
+using namespace ptk;
+
+enum {
+  TASKS   = 6,
+  HORIZON = 200000
+};
+
+static const ptk_time_t periods[TASKS] = { 20, 30, 50, 80, 120, 200 };
+
+static uint64_t sim_now;
+static ptk_time_t sim_busy;
+
+class Job : public Thread {
+  ptk_time_t period, cost;
+  bool edf;
+  uint64_t release, finish;
+
+public:
+  unsigned jobs, misses;
+
+  Job(ptk_time_t p, ptk_time_t c, bool e) :
+    period(p), cost(c), edf(e), release(0), finish(0), jobs(0), misses(0) {}
+
+  virtual void run() {
+    PTK_BEGIN();
+    while (1) {
+      // the driver moves the clock by cost once this returns
+      sim_busy = cost;
+      finish = sim_now + cost;
+      jobs++;
+      if (finish > release + period) misses++;
+
+      release += period;
+      if (edf) {
+        // due at the end of the next period, counted from the next wakeup
+        uint64_t wake = release > finish ? release : finish;
+        uint64_t due = release + period;
+        set_deadline(due > wake ? due - wake : 1);
+      }
+      PTK_SLEEP(release > finish ? release - finish : 0);
+    }
+    PTK_END();
+  }
+};
+
+static void tick() {
+  enter_isr();
+  expire_timers(1);
+  leave_isr();
+}
+
+static void advance(ptk_time_t ticks) {
+  while (ticks--) {
+    sim_now++;
+    port::run_as_interrupt(&tick);
+  }
+}
+
+static void simulate(double load, bool edf) {
+  Kernel *kernel = new Kernel;
+  the_kernel = kernel;
+  sim_now = 0;
+
+  // every task gets an equal share of the load
+  Job *jobs[TASKS];
+  double actual = 0;
+  for (int i=0; i < TASKS; ++i) {
+    ptk_time_t cost = (ptk_time_t) (load * periods[i] / TASKS + 0.5);
+    if (cost == 0) cost = 1;
+    actual += (double) cost / periods[i];
+
+    jobs[i] = new Job(periods[i], cost, edf);
+    if (edf) jobs[i]->set_deadline(periods[i]);
+    kernel->lock();
+    kernel->schedule(*jobs[i]);
+    kernel->unlock();
+  }
+
+  while (sim_now < HORIZON) {
+    sim_busy = 0;
+    if (kernel->run_once()) {
+      advance(sim_busy);
+    } else {
+      advance(1);
+    }
+  }
+
+  unsigned total = 0, missed = 0;
+  for (int i=0; i < TASKS; ++i) {
+    total += jobs[i]->jobs;
+    missed += jobs[i]->misses;
+  }
+
+  char what[64];
+  snprintf(what, sizeof(what), "%s, load %.2f, %u jobs", edf ? "EDF " : "FIFO", actual, total);
+  bench::report(what, 100.0 * missed / total, "% missed");
+
+  for (int i=0; i < TASKS; ++i) delete jobs[i];
+  the_kernel = 0;
+  delete kernel;
+}
+
+int main() {
+  static const double loads[] = { 0.5, 0.7, 0.85, 0.95, 1.05, 1.2, 1.5 };
+
+  for (unsigned i=0; i < sizeof(loads) / sizeof(loads[0]); ++i) {
+    simulate(loads[i], false);
+    simulate(loads[i], true);
+  }
+
+  return 0;
+}
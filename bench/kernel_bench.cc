@@ -0,0 +1,180 @@
+/*
+ * Baseline costs of the Kernel on the Linux host port: the critical section,
+ * dispatching yielding protothreads one at a time and in batches, a timer
+ * tick with many armed timers, a broadcast to many waiters, and the two ways
+ * an interrupt handler can signal an event.
+ */
+#include "bench.h"
+#include "ptk/ptk.h"
+#include "ptk/port.h"
+
+
+using namespace ptk;
+
+class Yielder : public Thread {
+public:
+  virtual void run() {
+    PTK_BEGIN();
+    while (1) PTK_YIELD();
+    PTK_END();
+  }
+};
+
+class Listener : public Thread {
+public:
+  Event &event;
+
+  Listener(Event &e) : event(e) {}
+
+  virtual void run() {
+    PTK_BEGIN();
+    while (1) PTK_WAIT_EVENT(event, TIME_INFINITE);
+    PTK_END();
+  }
+};
+
+class IdleTimer : public Timer {
+  virtual void timer_expired() {}
+};
+
+static void tick() {
+  enter_isr();
+  expire_timers(1);
+  leave_isr();
+}
+
+static void bench_lock(Kernel &kernel) {
+  enum { N = 10000000 };
+  bench::Stopwatch sw;
+  for (int i=0; i < N; ++i) {
+    kernel.lock();
+    kernel.unlock();
+  }
+  bench::report("lock()/unlock() pair", sw.ns_per(N), "ns");
+}
+
+static void bench_dispatch(Kernel &kernel, int threads) {
+  enum { N = 5000000 };
+  Yielder *yielders = new Yielder[threads];
+
+  kernel.lock();
+  for (int i=0; i < threads; ++i) kernel.schedule(yielders[i]);
+  kernel.unlock();
+
+  bench::Stopwatch sw;
+  for (int i=0; i < N; ++i) kernel.run_once();
+
+  char what[64];
+  snprintf(what, sizeof(what), "run_once() with %d ready threads", threads);
+  bench::report(what, sw.ns_per(N), "ns");
+
+  sw.reset();
+  for (int i=0; i < N; i += 1000) kernel.run(1000);
+  snprintf(what, sizeof(what), "run(1000) with %d ready threads", threads);
+  bench::report(what, sw.ns_per(N), "ns/thread");
+
+  kernel.lock();
+  for (int i=0; i < threads; ++i) kernel.unschedule(yielders[i]);
+  kernel.unlock();
+  delete[] yielders;
+}
+
+static void bench_tick(Kernel &kernel, int timers) {
+  enum { N = 200000 };
+  IdleTimer *idle = new IdleTimer[timers];
+
+  kernel.lock();
+  for (int i=0; i < timers; ++i) kernel.arm_timer(idle[i], TIME_INFINITE - 1 - i);
+  kernel.unlock();
+
+  bench::Stopwatch sw;
+  for (int i=0; i < N; ++i) port::run_as_interrupt(&tick);
+
+  char what[64];
+  snprintf(what, sizeof(what), "expire_timers(1) with %d armed timers", timers);
+  bench::report(what, sw.ns_per(N), "ns");
+
+  kernel.lock();
+  for (int i=0; i < timers; ++i) kernel.disarm_timer(idle[i]);
+  kernel.unlock();
+  delete[] idle;
+}
+
+// only the broadcast itself is timed, which is what holds interrupts off
+static void bench_broadcast(Kernel &kernel, int waiters) {
+  enum { N = 100000 };
+  static Event event;
+  kernel.lock();
+  for (int i=0; i < waiters; ++i) kernel.schedule(*new Listener(event));
+  kernel.unlock();
+  while (kernel.run_once()) ;
+
+  uint64_t total = 0;
+  for (int i=0; i < N; ++i) {
+    kernel.lock();
+    bench::Stopwatch sw;
+    kernel.broadcast_event(event, 1);
+    total += sw.elapsed();
+    kernel.unlock();
+    while (kernel.run_once()) ;
+  }
+
+  char what[64];
+  snprintf(what, sizeof(what), "broadcast_event() to %d waiters", waiters);
+  bench::report(what, (double) total / N, "ns");
+}
+
+static Event isr_event;
+
+static void locked_isr() {
+  enter_isr();
+  lock_from_isr();
+  broadcast_event(isr_event, 1);
+  unlock_from_isr();
+  leave_isr();
+}
+
+static void posting_isr() {
+  enter_isr();
+  post_event(isr_event, 1);
+  leave_isr();
+}
+
+static void bench_isr_signal(Kernel &kernel, port::isr_t isr, const char *what) {
+  enum { N = 5000000 };
+
+  // run_once() finds nothing to run, but takes whatever was posted
+  bench::Stopwatch sw;
+  for (int i=0; i < N; ++i) {
+    port::run_as_interrupt(isr);
+    kernel.run_once();
+  }
+  bench::report(what, sw.ns_per(N), "ns");
+}
+
+int main() {
+  static Kernel kernel;
+  the_kernel = &kernel;
+
+  bench_lock(kernel);
+
+  bench_dispatch(kernel, 1);
+  bench_dispatch(kernel, 16);
+  bench_dispatch(kernel, 256);
+
+  bench_tick(kernel, 0);
+  bench_tick(kernel, 16);
+  bench_tick(kernel, 256);
+  bench_tick(kernel, 1024);
+
+  bench_broadcast(kernel, 1);
+  bench_broadcast(kernel, 16);
+  bench_broadcast(kernel, 256);
+
+  bench_isr_signal(kernel, &locked_isr, "locked broadcast_event() + run_once()");
+  bench_isr_signal(kernel, &posting_isr, "post_event() + run_once()");
+
+  // the static ShellCommand threads outlive this kernel
+  the_kernel = 0;
+  return 0;
+}
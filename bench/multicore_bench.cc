@@ -0,0 +1,128 @@
+/*
+ * Dispatch throughput of a PTK_MULTICORE build with 1 to 8 cores. Every
+ * thread starts out on core 0, so the other cores only get work by stealing
+ * it. Each dispatch does a couple of microseconds of arithmetic, which is
+ * enough for the stealing and the remote wakeups to stay off the
+ * critical path.
+ */
+#include "bench.h"
+#include "ptk/ptk.h"
+#include "ptk/port.h"
+
+#include <thread>
+#include <vector>
+#include <unistd.h>
+
+#if !defined(PTK_MULTICORE)
+#error "multicore_bench must be built with PTK_MULTICORE"
+#endif
+
+using namespace ptk;
+
+enum {
+  THREADS  = 64,
+  WORK     = 2000,
+  RUN_MSEC = 300
+};
+
+class Worker : public Thread {
+  volatile uint32_t sum;
+
+public:
+  Worker() : sum(0) {}
+
+  virtual void run() {
+    PTK_BEGIN();
+    while (1) {
+      for (uint32_t i=0; i < WORK; ++i) sum = sum * 31 + i;
+      PTK_YIELD();
+    }
+    PTK_END();
+  }
+};
+
+static volatile bool stopping;
+static volatile int started;
+static volatile int exited;
+static uint64_t dispatches;
+
+static void core_main(int cores, Worker *workers) {
+  Kernel kernel;
+  the_kernel = &kernel;
+
+  // run() starts the others once this one is up, so it gets core 0
+  kernel.attach_core();
+  port::start();
+  kernel.set_idle_hook(&port::idle);
+
+  if (kernel.core() == 0) {
+    kernel.lock();
+    for (int i=0; i < THREADS; ++i) kernel.schedule(workers[i]);
+    kernel.unlock();
+  }
+
+  __atomic_add_fetch(&started, 1, __ATOMIC_SEQ_CST);
+  while (__atomic_load_n(&started, __ATOMIC_ACQUIRE) < cores) ;
+
+  uint64_t count = 0;
+  while (!__atomic_load_n(&stopping, __ATOMIC_RELAXED)) {
+    if (kernel.run_once()) count++;
+  }
+  __atomic_add_fetch(&dispatches, count, __ATOMIC_SEQ_CST);
+
+  // nobody may steal from a detached kernel, so wait for everyone to stop
+  __atomic_add_fetch(&exited, 1, __ATOMIC_SEQ_CST);
+  while (__atomic_load_n(&exited, __ATOMIC_ACQUIRE) < cores) ;
+
+  port::stop();
+  kernel.detach_core();
+  the_kernel = 0;
+}
+
+static double run(int cores) {
+  Worker *workers = new Worker[THREADS];
+  std::vector<std::thread> threads;
+
+  stopping = false;
+  started = 0;
+  exited = 0;
+  dispatches = 0;
+
+  threads.push_back(std::thread(core_main, cores, workers));
+  while (__atomic_load_n(&started, __ATOMIC_ACQUIRE) == 0) usleep(100);
+  for (int i=1; i < cores; ++i) threads.push_back(std::thread(core_main, cores, workers));
+  while (__atomic_load_n(&started, __ATOMIC_ACQUIRE) < cores) usleep(100);
+
+  bench::Stopwatch sw;
+  usleep(RUN_MSEC * 1000);
+  __atomic_store_n(&stopping, true, __ATOMIC_RELAXED);
+
+  // idle cores sleep until something interrupts them
+  while (__atomic_load_n(&exited, __ATOMIC_ACQUIRE) < cores) {
+    for (int i=0; i < cores; ++i) port::wake_core(i);
+    usleep(1000);
+  }
+  double seconds = sw.elapsed() / 1e9;
+
+  for (auto &t : threads) t.join();
+  delete[] workers;
+  return dispatches / seconds;
+}
+
+int main() {
+  printf("multicore: %d threads, %ld online cpus\n", THREADS, sysconf(_SC_NPROCESSORS_ONLN));
+
+  double base = 0;
+  for (int cores=1; cores <= 8; cores *= 2) {
+    double rate = run(cores);
+    if (cores == 1) base = rate;
+
+    char what[64];
+    snprintf(what, sizeof(what), "%d cores, dispatches", cores);
+    bench::report(what, rate / 1000, "k/s");
+    snprintf(what, sizeof(what), "%d cores, speedup", cores);
+    bench::report(what, rate / base, "x");
+  }
+
+  return 0;
+}
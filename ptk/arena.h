@@ -0,0 +1,114 @@
+#pragma once
+
+#include "ptk/assert.h"
+#include <new>
+#include <type_traits>
+#include <stddef.h>
+#include <stdint.h>
+
+namespace ptk {
+  /**
+   * @class Arena
+   * @brief Bump allocator over a fixed buffer, freed by rewinding
+   *
+   * allocate() just moves a pointer forward, so it costs a few instructions
+   * and never fragments. Memory is given back in bulk: mark() remembers the
+   * current position, and rewind() frees everything allocated after it.
+   * Arena::Scope does the same for a block of code. Rewinding doesn't run
+   * destructors, so keep to objects that don't need them.
+   *
+   * An Arena isn't locked. Use each one from a single thread, never from an
+   * interrupt handler. A protothread that yields in the middle of a scope
+   * keeps its allocations until it rewinds, so whoever shares the arena
+   * should rewind in the same order they marked.
+   *
+   * @code
+   * static StaticArena<1024> scratch;
+   *
+   * {
+   *   Arena::Scope scope(scratch);
+   *   char *line = (char *) scratch.allocate(80, 1);
+   *   ...
+   * } // line is freed here
+   * @endcode
+   */
+  class Arena {
+    char *const base;
+    const size_t size;
+    size_t top;
+    size_t most_used;
+
+  public:
+    typedef size_t mark_t;
+
+    Arena(void *buffer, size_t bytes) :
+      base(static_cast<char *>(buffer)), size(bytes), top(0), most_used(0) {}
+
+    /**
+     * @brief takes bytes from the arena
+     * @param[in] align must be a power of two
+     * @returns 0 if there isn't enough room left
+     */
+    void *allocate(size_t bytes, size_t align = alignof(max_align_t)) {
+      uintptr_t start = ((uintptr_t) base + top + align - 1) & ~(uintptr_t) (align - 1);
+      size_t end = start - (uintptr_t) base + bytes;
+      if (end > size) return 0;
+
+      top = end;
+      if (top > most_used) most_used = top;
+      return (void *) start;
+    }
+
+    /**
+     * @brief constructs a T in the arena
+     * @returns 0 if there isn't enough room left
+     */
+    template<class T, class... Args>
+    T *create(Args&&... args) {
+      void *p = allocate(sizeof(T), alignof(T));
+      return p ? new (p) T(static_cast<Args&&>(args)...) : 0;
+    }
+
+    mark_t mark() const { return top; }
+
+    // frees everything allocated since m was taken
+    void rewind(mark_t m) {
+      PTK_ASSERT(m <= top, "Arena rewound past its current position.");
+      top = m;
+    }
+
+    void reset() { top = 0; }
+
+    size_t used() const { return top; }
+    size_t available() const { return size - top; }
+    size_t capacity() const { return size; }
+
+    // the most bytes that were ever in use at once, counting padding
+    size_t high_water() const { return most_used; }
+    void reset_high_water() { most_used = top; }
+
+    /**
+     * @brief rewinds the arena to where it was when the scope began
+     */
+    class Scope {
+      Arena &arena;
+      const mark_t start;
+
+    public:
+      Scope(Arena &a) : arena(a), start(a.mark()) {}
+      ~Scope() { arena.rewind(start); }
+    };
+  };
+
+  /**
+   * @class StaticArena
+   * @brief Arena with its own buffer of N bytes
+   */
+  template<size_t N>
+  class StaticArena : public Arena {
+    typename std::aligned_storage<N, alignof(max_align_t)>::type buffer;
+
+  public:
+    StaticArena() : Arena(&buffer, N) {}
+  };
+}
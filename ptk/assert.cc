@@ -1,3 +1,23 @@
+#include "ptk/config.h"
+
+#if defined(PTK_PORT_LINUX)
+#include <cstdio>
+#include <cstdlib>
+
+extern "C" {
+  void ptk_halt(const char *msg) {
+    fprintf(stderr, "ptk_halt: %s\n", msg);
+    abort();
+  }
+
+  void ptk_assert_failure(const char *msg, const char *file, int line) {
+    fprintf(stderr, "%s:%d: %s\n", file, line, msg);
+    abort();
+  }
+}
+
+#else
+
 extern "C" {
   void ptk_halt(const char *msg) {
     while (1);
@@ -5,3 +25,5 @@ extern "C" {
 
   void ptk_assert_failure(const char *msg, const char *file, int line) __attribute__ ((weak, alias("ptk_halt")));
 }
+
+#endif
@@ -0,0 +1,46 @@
+#pragma once
+
+#include "ptk/config.h"
+
+namespace ptk {
+  /**
+   * @class CoreLock
+   * @brief Spin lock for data shared between the cores of a PTK_MULTICORE build
+   *
+   * Interrupt masking only protects a core from its own interrupt handlers.
+   * Data that other cores can reach, like a Kernel's ready lists or an
+   * Event's waiters, also needs one of these. Without PTK_MULTICORE there is
+   * only one core, and every operation compiles to nothing.
+   */
+  class CoreLock {
+#if defined(PTK_MULTICORE)
+    volatile bool held;
+
+  public:
+    CoreLock() : held(false) {}
+
+    bool try_acquire() {
+      return !__atomic_exchange_n(&held, true, __ATOMIC_ACQUIRE);
+    }
+
+    void acquire() {
+      while (!try_acquire()) {
+        while (__atomic_load_n(&held, __ATOMIC_RELAXED)) {
+#if defined(__x86_64__) || defined(__i386__)
+          __builtin_ia32_pause();
+#endif
+        }
+      }
+    }
+
+    void release() {
+      __atomic_store_n(&held, false, __ATOMIC_RELEASE);
+    }
+#else
+  public:
+    bool try_acquire() { return true; }
+    void acquire() {}
+    void release() {}
+#endif
+  };
+}
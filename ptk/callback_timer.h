@@ -0,0 +1,132 @@
+#pragma once
+
+#include "ptk/kernel.h"
+#include "ptk/timer.h"
+
+namespace ptk {
+  /**
+   * @class CallbackTimer
+   * @brief One-shot timer that calls a function instead of waking a thread
+   *
+   * Timed work that doesn't wait on anything, like kicking a watchdog or
+   * starting an ADC conversion, doesn't need a whole Thread. The callback
+   * runs from expire_timers(), usually in the tick interrupt, so keep it
+   * short. It may use post_event(), and may start the timer again between
+   * lock_from_isr() and unlock_from_isr().
+   *
+   * F is anything that can be called with no arguments: a plain function
+   * pointer by default, or a small function object.
+   *
+   * @code
+   * static CallbackTimer<> kick(&kick_watchdog);
+   *
+   * lock_kernel();
+   * kick.start(100);
+   * unlock_kernel();
+   * @endcode
+   */
+  template<class F = void (*)()>
+  class CallbackTimer : public Timer {
+    F callback;
+
+    virtual void timer_expired() {
+      timer_expiration = TIME_NEVER;
+      callback();
+    }
+
+  public:
+    explicit CallbackTimer(const F &f) : callback(f) {}
+
+    /**
+     * @brief calls the callback once, after delay ticks
+     *
+     * The kernel must be locked. Starting a timer that is already running
+     * starts it over.
+     */
+    void start(ptk_time_t delay) {
+      stop();
+      arm_timer(*this, delay);
+    }
+
+    /**
+     * @brief cancels the call, if it hasn't happened yet
+     *
+     * The kernel must be locked.
+     */
+    void stop() {
+      if (timer_expiration != TIME_NEVER) disarm_timer(*this);
+    }
+
+    bool running() const { return timer_expiration != TIME_NEVER; }
+  };
+
+  /**
+   * @class PeriodicTimer
+   * @brief Timer that calls a function every period ticks
+   *
+   * Each expiry arms the next one at an absolute tick, counted from the
+   * time it was due rather than from when it ran, so a late tick doesn't
+   * shift all the following ones. If the timer falls a whole period or
+   * more behind, the missed calls are skipped rather than made in a burst,
+   * and counted in overruns(). Otherwise it's like a CallbackTimer, and
+   * the callback may stop it.
+   */
+  template<class F = void (*)()>
+  class PeriodicTimer : public Timer {
+    F callback;
+    ptk_time_t period;
+    uint32_t missed;
+
+    virtual void timer_expired() {
+      const ptk_time_t late = timer_expiration;
+      timer_expiration = TIME_NEVER;
+
+      // the next deadline still ahead, counted from the one just missed
+      const ptk_time_t skipped = late / period;
+      missed += skipped;
+
+      lock_from_isr();
+      arm_timer_at(*this, timer_deadline + (uint64_t) (skipped + 1) * period);
+      unlock_from_isr();
+
+      callback();
+    }
+
+  public:
+    explicit PeriodicTimer(const F &f) : callback(f), period(0), missed(0) {}
+
+    /**
+     * @brief calls the callback every p ticks, the first time after p
+     *
+     * The kernel must be locked. Starting a timer that is already running
+     * starts it over with the new period.
+     */
+    void start(ptk_time_t p) {
+      start(p, p);
+    }
+
+    /**
+     * @brief calls the callback every p ticks, the first time after first
+     */
+    void start(ptk_time_t p, ptk_time_t first) {
+      PTK_ASSERT(p > 0 && p < TIME_INFINITE, "PeriodicTimer period out of range.");
+      stop();
+      period = p;
+      arm_timer(*this, first);
+    }
+
+    /**
+     * @brief stops the calls
+     *
+     * The kernel must be locked, with lock_from_isr() in the callback.
+     */
+    void stop() {
+      if (timer_expiration != TIME_NEVER) disarm_timer(*this);
+    }
+
+    bool running() const { return timer_expiration != TIME_NEVER; }
+
+    // the number of calls skipped because the timer fell behind
+    uint32_t overruns() const { return missed; }
+  };
+}
@@ -0,0 +1,256 @@
+#pragma once
+
+/*
+ * Build-time configuration for libptk. Each application provides its own
+ * conf_ptk.h somewhere on the include path. Options left undefined there
+ * fall back to the defaults below.
+ */
+#include "conf_ptk.h"
+
+/*
+ * Port
+ *
+ * Selects the implementation of ptk/port.h. See that file for details.
+ */
+#if !defined(PTK_PORT_LINUX) && !defined(PTK_PORT_CORTEXM)
+#if defined(__linux__)
+#define PTK_PORT_LINUX
+#else
+#define PTK_PORT_CORTEXM
+#endif
+#endif
+
+/*
+ * Armed timer queue
+ *
+ * Every armed timer holds its absolute deadline on the kernel's 64-bit
+ * tick clock, so a tick never has to update the timers that stay armed.
+ * By default the Kernel keeps them in a plain list, and scans all of them
+ * on each tick that reaches the earliest deadline. Arming costs O(1). Two
+ * alternatives can be selected instead:
+ *
+ * PTK_TIMER_WHEEL uses a hierarchical timing wheel. A tick costs O(1)
+ * amortized, whatever the number of armed timers, but with the default
+ * PTK_TIMER_WHEEL_BITS the wheel needs about a kilobyte of list heads.
+ *
+ * PTK_TIMER_SORTED_LIST keeps the list sorted by deadline. A tick only
+ * looks at the head of the list, and arming costs O(armed timers). This
+ * suits builds with few timers, where the wheel costs too much RAM.
+ *
+ * PTK_TIMER_WHEEL_BITS sets the number of slots per wheel level (1 << bits).
+ * Enough levels are allocated to cover the full range of ptk_time_t. Fewer
+ * bits mean less RAM but more cascading between levels.
+ */
+#if defined(PTK_TIMER_WHEEL) && defined(PTK_TIMER_SORTED_LIST)
+#error "Define at most one of PTK_TIMER_WHEEL and PTK_TIMER_SORTED_LIST"
+#endif
+
+#if !defined(PTK_TIMER_WHEEL_BITS)
+#define PTK_TIMER_WHEEL_BITS 4
+#endif
+
+#if (PTK_TIMER_WHEEL_BITS < 2) || (PTK_TIMER_WHEEL_BITS > 5)
+#error "PTK_TIMER_WHEEL_BITS must be between 2 and 5"
+#endif
+
+/*
+ * Scheduling priorities
+ *
+ * The Kernel keeps one ready list per priority level and always runs the
+ * highest ready level first. Threads on the same level take turns in FIFO
+ * order. Higher numbers mean higher priority. Threads get
+ * PTK_DEFAULT_PRIORITY unless their constructor asks for something else,
+ * so a build where nobody sets a priority schedules exactly like a single
+ * FIFO.
+ */
+#if !defined(PTK_PRIORITY_LEVELS)
+#define PTK_PRIORITY_LEVELS 8
+#endif
+
+#if (PTK_PRIORITY_LEVELS < 1) || (PTK_PRIORITY_LEVELS > 32)
+#error "PTK_PRIORITY_LEVELS must be between 1 and 32"
+#endif
+
+#if !defined(PTK_DEFAULT_PRIORITY)
+#define PTK_DEFAULT_PRIORITY (PTK_PRIORITY_LEVELS / 2)
+#endif
+
+/*
+ * Earliest deadline first
+ *
+ * PTK_EDF keeps the ready threads in a heap instead of one FIFO per level.
+ * Priority still comes first, but within a level the thread with the
+ * earliest deadline runs next. A thread declares a relative deadline with
+ * Thread::set_deadline(), usually before it sleeps or waits, and gets an
+ * absolute deadline each time it's woken. Threads without one run after
+ * those that have one, in FIFO order, so a build where nobody sets a
+ * deadline schedules as before. PTK_EDF_MAX_READY caps the number of
+ * threads that can be ready at once. Not available with PTK_MULTICORE.
+ */
+#if defined(PTK_EDF) && defined(PTK_MULTICORE)
+#error "PTK_EDF doesn't support PTK_MULTICORE"
+#endif
+
+#if !defined(PTK_EDF_MAX_READY)
+#define PTK_EDF_MAX_READY 32
+#endif
+
+#if (PTK_EDF_MAX_READY < 1) || (PTK_EDF_MAX_READY > 0xfffe)
+#error "PTK_EDF_MAX_READY must be between 1 and 65534"
+#endif
+
+/*
+ * Batched dispatch
+ *
+ * Kernel::run() takes up to PTK_RUN_BATCH ready threads per critical
+ * section. Larger batches save more locking, but a thread that becomes
+ * ready during a batch can wait for the whole batch to finish.
+ */
+#if !defined(PTK_RUN_BATCH)
+#define PTK_RUN_BATCH 8
+#endif
+
+#if PTK_RUN_BATCH < 1
+#error "PTK_RUN_BATCH must be at least 1"
+#endif
+
+/*
+ * Lazy broadcast
+ *
+ * When every thread waiting on an event has the same priority,
+ * Kernel::broadcast_event() moves the whole wait list onto the ready list
+ * in one step, and each thread's wakeup is finished when it is taken to
+ * run. Define PTK_EAGER_BROADCAST to wake them one at a time instead. The
+ * EDF and multicore schedulers always do, since their ready queues aren't
+ * plain lists.
+ */
+#if !defined(PTK_EAGER_BROADCAST) && !defined(PTK_EDF) && !defined(PTK_MULTICORE)
+#define PTK_LAZY_BROADCAST
+#endif
+
+/*
+ * Scheduler trace
+ *
+ * PTK_TRACE gives each Kernel a ring buffer of timestamped scheduler
+ * records. See ptk/trace.h. PTK_TRACE_RECORDS sets the size of the ring,
+ * at 16 bytes per record, and must be a power of two.
+ */
+#if !defined(PTK_TRACE_RECORDS)
+#define PTK_TRACE_RECORDS 256
+#endif
+
+#if (PTK_TRACE_RECORDS & (PTK_TRACE_RECORDS - 1)) != 0
+#error "PTK_TRACE_RECORDS must be a power of two"
+#endif
+
+/*
+ * Thread statistics
+ *
+ * PTK_THREAD_STATS makes the Kernel count, for every thread, how often it
+ * ran, how long run() took in total and at most, and how often it was
+ * woken for each reason. Times come from the kernel's cycle counter, which
+ * is port::timestamp() unless Kernel::set_cycle_counter() picks another.
+ * The "top" shell command shows the result.
+ *
+ * PTK_WAKEUP_LATENCY also times how long each woken thread waits before it
+ * runs, from the wakeup(), signal or timeout that readied it. Samples go
+ * into a histogram on the thread and another on the Event that woke it,
+ * with PTK_LATENCY_BUCKETS power-of-two buckets of cycle counter units.
+ * The "latency" shell command shows and resets them. It implies
+ * PTK_THREAD_STATS.
+ */
+#if defined(PTK_WAKEUP_LATENCY) && !defined(PTK_THREAD_STATS)
+#define PTK_THREAD_STATS
+#endif
+
+#if !defined(PTK_LATENCY_BUCKETS)
+#define PTK_LATENCY_BUCKETS 24
+#endif
+
+#if (PTK_LATENCY_BUCKETS < 2) || (PTK_LATENCY_BUCKETS > 32)
+#error "PTK_LATENCY_BUCKETS must be between 2 and 32"
+#endif
+
+/*
+ * Run-time budget
+ *
+ * A thread that runs too long before it yields holds up every other
+ * thread. Define PTK_RUN_BUDGET as the longest a run() may take, in cycle
+ * counter units, and the Kernel reports each dispatch that goes over:
+ * it counts it on the thread, remembers the last one, and calls the hook
+ * from Kernel::set_overrun_hook(). Kernel::set_run_budget() and
+ * Thread::set_run_budget() change the budget at run time. The "threads"
+ * shell command shows the overruns. It implies PTK_THREAD_STATS.
+ */
+#if defined(PTK_RUN_BUDGET) && !defined(PTK_THREAD_STATS)
+#define PTK_THREAD_STATS
+#endif
+
+/*
+ * Waiting on several events
+ *
+ * PTK_WAIT_EVENTS() takes up to PTK_MAX_WAIT_EVENTS events. Each one
+ * costs a wait node while the thread waits, from a pool of PTK_WAIT_NODES
+ * shared by every thread.
+ */
+#if !defined(PTK_MAX_WAIT_EVENTS)
+#define PTK_MAX_WAIT_EVENTS 4
+#endif
+
+#if !defined(PTK_WAIT_NODES)
+#define PTK_WAIT_NODES 16
+#endif
+
+#if (PTK_WAIT_NODES < 1) || (PTK_WAIT_NODES > 0xfffe)
+#error "PTK_WAIT_NODES must be between 1 and 65534"
+#endif
+
+/*
+ * Coroutine threads
+ *
+ * The CoThreads in ptk/cothread.h, which needs C++20, keep their coroutine
+ * frames in a pool of PTK_COTHREAD_FRAMES blocks, PTK_COTHREAD_FRAME_SIZE
+ * bytes each. A frame holds the body's locals along with some bookkeeping
+ * by the compiler, and is much larger in unoptimized builds.
+ */
+#if !defined(PTK_COTHREAD_FRAMES)
+#define PTK_COTHREAD_FRAMES 8
+#endif
+
+#if !defined(PTK_COTHREAD_FRAME_SIZE)
+#define PTK_COTHREAD_FRAME_SIZE 256
+#endif
+
+#if (PTK_COTHREAD_FRAMES < 1) || (PTK_COTHREAD_FRAMES > 0xfffe)
+#error "PTK_COTHREAD_FRAMES must be between 1 and 65534"
+#endif
+
+/*
+ * Multi-core
+ *
+ * With PTK_MULTICORE, each worker OS thread runs its own Kernel. The_kernel
+ * is then thread-local, and each Kernel calls attach_core() on its worker
+ * before it starts. Threads are woken on the core that last ran them,
+ * through a lock-free queue of remote wakeups. Cores with nothing to do
+ * steal ready threads from busy ones. Only the Linux port supports this
+ * mode. PTK_MAX_CORES limits the number of attached kernels.
+ *
+ * PTK_CORE_LOCAL marks variables that need one copy per core.
+ */
+#if defined(PTK_MULTICORE)
+#if !defined(PTK_PORT_LINUX)
+#error "PTK_MULTICORE requires PTK_PORT_LINUX"
+#endif
+
+#if !defined(PTK_MAX_CORES)
+#define PTK_MAX_CORES 16
+#endif
+
+#if PTK_MAX_CORES > 32
+#error "PTK_MAX_CORES must be 32 or less"
+#endif
+
+#define PTK_CORE_LOCAL thread_local
+#else
+#define PTK_CORE_LOCAL
+#endif
@@ -0,0 +1,57 @@
+#pragma once
+
+#include "ptk/timer.h"
+#include <stdint.h>
+
+/*
+ * ARM Cortex-M port. Critical sections mask interrupts with PRIMASK.
+ * timestamp() reads the DWT cycle counter, which Cortex-M0/M0+ parts lack.
+ * Those ports should define PTK_PORT_NO_DWT, and timestamp() then always
+ * returns 0. The counter runs at the core clock. Define
+ * PTK_PORT_TIMESTAMP_HZ if the device has no CMSIS SystemCoreClock.
+ */
+#if !defined(PTK_PORT_TIMESTAMP_HZ)
+extern "C" uint32_t SystemCoreClock;
+#define PTK_PORT_TIMESTAMP_HZ SystemCoreClock
+#endif
+
+namespace ptk {
+  namespace port {
+    inline void disable_interrupts() {
+      asm volatile ("cpsid i" : : : "memory");
+    }
+
+    inline void enable_interrupts() {
+      asm volatile ("cpsie i" : : : "memory");
+    }
+
+    inline bool in_isr() {
+      uint32_t ipsr;
+      asm volatile ("mrs %0, ipsr" : "=r" (ipsr));
+      return ipsr != 0;
+    }
+
+    inline uint32_t timestamp() {
+#if defined(PTK_PORT_NO_DWT)
+      return 0;
+#else
+      volatile uint32_t *const DWT_CYCCNT = (volatile uint32_t *) 0xe0001004;
+      return *DWT_CYCCNT;
+#endif
+    }
+
+    inline uint32_t timestamp_hz() {
+      return PTK_PORT_TIMESTAMP_HZ;
+    }
+
+    /*
+     * WFI wakes up on a pending interrupt even with PRIMASK set. This does
+     * not program a wakeup for the deadline, so boards that want to sleep
+     * through their periodic tick need their own idle hook.
+     */
+    inline void idle(ptk_time_t duration) {
+      (void) duration;
+      asm volatile ("wfi" : : : "memory");
+    }
+  }
+}
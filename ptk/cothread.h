@@ -0,0 +1,370 @@
+#pragma once
+
+#if !defined(__cpp_impl_coroutine)
+#error "ptk/cothread.h needs C++20 coroutines"
+#endif
+
+#include "ptk/assert.h"
+#include "ptk/kernel.h"
+#include "ptk/thread.h"
+#include "ptk/io.h"
+#include "ptk/pool.h"
+#include <coroutine>
+#include <source_location>
+
+namespace ptk {
+  /**
+   * @class CoThread
+   * @brief Thread whose body is a C++20 coroutine
+   *
+   * A CoThread is scheduled, woken and destroyed like any other Thread, and
+   * sits on the same ready lists. Its body() suspends with co_await instead
+   * of the PTK_ macros. Locals keep their values across waits, and no
+   * labels-as-values extension is needed.
+   *
+   * The coroutine frame is taken from a pool of PTK_COTHREAD_FRAMES blocks
+   * when the thread first runs, and goes back when body() returns or the
+   * thread is destroyed. Nothing comes from the heap. If no block is free,
+   * or the body's frame doesn't fit in PTK_COTHREAD_FRAME_SIZE bytes, the
+   * first run fails an assertion.
+   *
+   * Like the SubThread it is, a CoThread can be waited on by its parent.
+   *
+   * @code
+   * class Blinker : public CoThread {
+   *   Body body() {
+   *     for (int i=0; ; ++i) {
+   *       led(i & 1);
+   *       co_await sleep(500);
+   *     }
+   *   }
+   * };
+   * @endcode
+   */
+  class CoThread : public SubThread {
+  public:
+    struct Frame {
+      alignas(max_align_t) uint8_t bytes[PTK_COTHREAD_FRAME_SIZE];
+    };
+
+    typedef Pool<Frame, PTK_COTHREAD_FRAMES> FramePool;
+
+    // shared by every CoThread, here for its usage statistics
+    static inline FramePool frames;
+
+    /*
+     * What body() returns. It only carries the new coroutine to the
+     * CoThread, which owns it from then on.
+     */
+    class Body {
+      friend class CoThread;
+
+    public:
+      struct promise_type {
+        static void *operator new(size_t bytes) noexcept {
+          return bytes <= sizeof(Frame) ? frames.allocate() : 0;
+        }
+
+        static void operator delete(void *p) {
+          frames.release(p);
+        }
+
+        static Body get_return_object_on_allocation_failure() { return Body(); }
+        Body get_return_object() { return Body(handle_t::from_promise(*this)); }
+
+        // the kernel's dispatch starts the body, not the call to body()
+        std::suspend_always initial_suspend() noexcept { return {}; }
+        std::suspend_always final_suspend() noexcept { return {}; }
+
+        void return_void() {}
+        void unhandled_exception() {
+          PTK_ASSERT(false, "Exception escaped a CoThread body.");
+        }
+      };
+
+      typedef std::coroutine_handle<promise_type> handle_t;
+
+    private:
+      handle_t handle;
+
+      Body() : handle() {}
+      explicit Body(handle_t h) : handle(h) {}
+    };
+
+  protected:
+    /*
+     * Awaitables for body(). Each one leaves the thread in the same state
+     * as the macro of the same name would, and records where it waited for
+     * the "threads" shell command. co_await on wait() and join() returns
+     * wakeup_reason. After wait() on a list of events, fired_event() says
+     * which one fired.
+     */
+    class Wait {
+    protected:
+      CoThread &thread;
+      std::source_location where;
+
+      Wait(CoThread &t, const std::source_location &w) : thread(t), where(w) {}
+
+      void save_location() {
+#if defined(PTK_DEBUG)
+        thread.debug_file = where.file_name();
+        thread.debug_line = where.line();
+#endif
+      }
+
+    public:
+      bool await_ready() { return false; }
+
+      wakeup_t await_resume() {
+        lock_kernel();
+        disarm_timer(thread);
+        unlock_kernel();
+        return thread.wakeup_reason;
+      }
+    };
+
+    class Yield : public Wait {
+    public:
+      Yield(CoThread &t, const std::source_location &w) : Wait(t, w) {}
+
+      void await_suspend(std::coroutine_handle<>) {
+        thread.state = YIELDED_STATE;
+        save_location();
+      }
+
+      void await_resume() {}
+    };
+
+    class Sleep : public Wait {
+      ptk_time_t duration;
+
+    public:
+      Sleep(CoThread &t, ptk_time_t d, const std::source_location &w) :
+        Wait(t, w), duration(d) {}
+
+      void await_suspend(std::coroutine_handle<>) {
+        lock_kernel();
+        thread.state = SLEEPING_STATE;
+        unschedule_thread(thread);
+        arm_timer(thread, duration);
+        unlock_kernel();
+        save_location();
+      }
+
+      void await_resume() {}
+    };
+
+    class SleepUntil : public Wait {
+      uint64_t when;
+
+    public:
+      SleepUntil(CoThread &t, uint64_t at, const std::source_location &w) :
+        Wait(t, w), when(at) {}
+
+      void await_suspend(std::coroutine_handle<>) {
+        lock_kernel();
+        thread.state = SLEEPING_STATE;
+        unschedule_thread(thread);
+        arm_timer_at(thread, when);
+        unlock_kernel();
+        save_location();
+      }
+
+      void await_resume() {}
+    };
+
+    class EventWait : public Wait {
+      Event &event;
+      ptk_time_t duration;
+
+    public:
+      EventWait(CoThread &t, Event &e, ptk_time_t d, const std::source_location &w) :
+        Wait(t, w), event(e), duration(d) {}
+
+      void await_suspend(std::coroutine_handle<>) {
+        thread.state = WAIT_EVENT_STATE;
+        wait_event(thread, event, duration);
+        save_location();
+      }
+    };
+
+    class EventsWait : public Wait {
+      EventList events;
+      ptk_time_t duration;
+
+    public:
+      EventsWait(CoThread &t, const EventList &e, ptk_time_t d, const std::source_location &w) :
+        Wait(t, w), events(e), duration(d) {}
+
+      void await_suspend(std::coroutine_handle<>) {
+        thread.state = WAIT_EVENTS_STATE;
+        wait_events(thread, events, duration);
+        save_location();
+      }
+    };
+
+    class Join : public Wait {
+      SubThread &sub;
+      ptk_time_t duration;
+
+    public:
+      Join(CoThread &t, SubThread &s, ptk_time_t d, const std::source_location &w) :
+        Wait(t, w), sub(s), duration(d) {}
+
+      void await_suspend(std::coroutine_handle<>) {
+        lock_kernel();
+        wait_subthread(thread, sub, duration);
+        thread.state = WAIT_SUBTHREAD_STATE;
+        unlock_kernel();
+        save_location();
+      }
+    };
+
+    // co_await returns the number of bytes read, 0 on timeout
+    class Read : public Wait {
+      DeviceInStream &in;
+      uint8_t *buffer;
+      size_t max, got;
+      ptk_time_t duration;
+
+    public:
+      Read(CoThread &t, DeviceInStream &s, uint8_t *b, size_t m, ptk_time_t d,
+           const std::source_location &w) :
+        Wait(t, w), in(s), buffer(b), max(m), got(0), duration(d) {}
+
+      bool await_ready() {
+        got = in.read(buffer, max);
+        return got > 0;
+      }
+
+      void await_suspend(std::coroutine_handle<>) {
+        thread.state = WAIT_EVENT_STATE;
+        wait_event(thread, in.not_empty, duration);
+        save_location();
+      }
+
+      size_t await_resume() {
+        if (got == 0) {
+          Wait::await_resume();
+          got = in.read(buffer, max);
+        }
+        return got;
+      }
+    };
+
+    // co_await returns the number of bytes written, short on timeout
+    class Write : public Wait {
+      DeviceOutStream &out;
+      const uint8_t *buffer;
+      size_t len, done;
+      ptk_time_t duration;
+
+    public:
+      Write(CoThread &t, DeviceOutStream &s, const uint8_t *b, size_t l, ptk_time_t d,
+            const std::source_location &w) :
+        Wait(t, w), out(s), buffer(b), len(l), done(0), duration(d) {}
+
+      bool await_ready() {
+        done = out.write(buffer, len);
+        return done == len;
+      }
+
+      void await_suspend(std::coroutine_handle<>) {
+        thread.state = WAIT_EVENT_STATE;
+        wait_event(thread, out.not_full, duration);
+        save_location();
+      }
+
+      size_t await_resume() {
+        if (done < len) {
+          Wait::await_resume();
+          done += out.write(buffer + done, len - done);
+        }
+        return done;
+      }
+    };
+
+    Yield yield(const std::source_location &w = std::source_location::current()) {
+      return Yield(*this, w);
+    }
+
+    Sleep sleep(ptk_time_t duration,
+                const std::source_location &w = std::source_location::current()) {
+      return Sleep(*this, duration, w);
+    }
+
+    SleepUntil sleep_until(uint64_t when,
+                           const std::source_location &w = std::source_location::current()) {
+      return SleepUntil(*this, when, w);
+    }
+
+    EventWait wait(Event &event, ptk_time_t duration,
+                   const std::source_location &w = std::source_location::current()) {
+      return EventWait(*this, event, duration, w);
+    }
+
+    EventsWait wait(const EventList &events, ptk_time_t duration,
+                    const std::source_location &w = std::source_location::current()) {
+      return EventsWait(*this, events, duration, w);
+    }
+
+    Join join(SubThread &sub, ptk_time_t duration,
+              const std::source_location &w = std::source_location::current()) {
+      return Join(*this, sub, duration, w);
+    }
+
+    Read read(DeviceInStream &in, uint8_t *buffer, size_t max, ptk_time_t duration,
+              const std::source_location &w = std::source_location::current()) {
+      return Read(*this, in, buffer, max, duration, w);
+    }
+
+    Write write(DeviceOutStream &out, const uint8_t *buffer, size_t len, ptk_time_t duration,
+                const std::source_location &w = std::source_location::current()) {
+      return Write(*this, out, buffer, len, duration, w);
+    }
+
+    virtual Body body() = 0;
+    virtual void run();
+    virtual void reset();
+
+  public:
+    CoThread(priority_t priority = PTK_DEFAULT_PRIORITY) :
+      SubThread(priority), frame() {}
+
+    virtual ~CoThread() {
+      if (frame) frame.destroy();
+    }
+
+  private:
+    Body::handle_t frame;
+  };
+
+  inline void CoThread::run() {
+    if (!frame) {
+      timer_expiration = TIME_NEVER;
+      frame = body().handle;
+      PTK_ASSERT(frame, "No CoThread frame free, or the body needs more than PTK_COTHREAD_FRAME_SIZE.");
+
+      // the shell lists threads that have somewhere to continue
+      continuation = frame.address();
+    }
+
+    frame.resume();
+    if (frame.done()) {
+      frame.destroy();
+      frame = Body::handle_t();
+      ptk_end();
+    }
+  }
+
+  inline void CoThread::reset() {
+    // a parent can restart a body that never finished
+    if (frame) {
+      frame.destroy();
+      frame = Body::handle_t();
+      continuation = 0;
+    }
+    SubThread::reset();
+  }
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include "ptk/thread.h"
+
+namespace ptk {
+  class Kernel;
+
+  /**
+   * @class DeferredCall
+   * @brief Work that an interrupt handler hands off to thread context
+   *
+   * An interrupt handler calls defer_call() on a DeferredCall it owns, and
+   * the kernel runs call() before it dispatches the next thread, with the
+   * kernel unlocked and interrupts enabled. The handler itself only does
+   * a compare-and-swap, and the work still runs sooner than a woken
+   * thread would. Pending calls run highest priority first, in the order
+   * they were deferred within a priority.
+   *
+   * Deferring a call that is already pending does nothing, so a burst of
+   * interrupts becomes a single call. call() may defer the same object
+   * again, and then runs again on the kernel's next pass. It must not
+   * block. To wait on something, wake a thread instead.
+   *
+   * @code
+   * class UsbBottomHalf : public DeferredCall {
+   *   virtual void call() { copy_packets(); post_event(rx_ready, 0); }
+   * } usb_bottom_half;
+   *
+   * void usb_isr() { ... defer_call(usb_bottom_half); }
+   * @endcode
+   */
+  class DeferredCall {
+    friend class Kernel;
+
+    DeferredCall *deferred_next;
+    volatile uint8_t deferred;
+
+  protected:
+    virtual void call() = 0;
+
+  public:
+    const priority_t priority;
+
+    DeferredCall(priority_t priority = PTK_DEFAULT_PRIORITY) :
+      deferred_next(0), deferred(0), priority(priority) {}
+
+    bool pending() const { return deferred != 0; }
+  };
+}
@@ -231,11 +231,17 @@ namespace ptk {
     T &push(T &element) { insert_before(element); return element; }
     void pop() { remove(*this->next); }
 
-    class Iterator : public std::iterator<std::forward_iterator_tag, T> {
+    class Iterator {
       T *p;
       DLink<T> T::* const member;
 
     public:
+      typedef std::forward_iterator_tag iterator_category;
+      typedef T value_type;
+      typedef ptrdiff_t difference_type;
+      typedef T *pointer;
+      typedef T &reference;
+
       Iterator(T *p0, DLink<T> T::*m) : p(p0), member(m) { }
       Iterator(const Iterator &other) : p(other.p), member(other.member) { }
       const Iterator &operator++() { p = (p->*member).next; return *this; }
@@ -1,18 +1,156 @@
 #pragma once
 
+#include "ptk/atomic.h"
 #include "ptk/thread.h"
 
 namespace ptk {
   typedef int32_t eventmask_t;
   class Thread;
+  class Event;
+
+  /*
+   * One event of a PTK_WAIT_EVENTS() wait, on that event's selecting list.
+   * The nodes of one wait are chained through next, and all go back to the
+   * kernel's pool when the first event fires or the wait times out.
+   */
+  struct EventWaitNode {
+    i2link_t link;
+    Thread *const thread;
+    Event *const event;
+    EventWaitNode *const next;
+    bool listed;
+
+    EventWaitNode(Thread &t, Event &e, EventWaitNode *n) :
+      thread(&t), event(&e), next(n), listed(false) {}
+  };
+
+  /*
+   * The events of a PTK_WAIT_EVENTS(), written as a braced list of
+   * pointers: {&rx_ready, &tx_space}
+   */
+  class EventList {
+    friend class ptk::Kernel;
+
+    Event *events[PTK_MAX_WAIT_EVENTS];
+    unsigned count;
+
+  public:
+    template<class... E>
+    EventList(E *... e) : events{e...}, count(sizeof...(E)) {
+      static_assert(sizeof...(E) > 0 && sizeof...(E) <= PTK_MAX_WAIT_EVENTS,
+                    "PTK_WAIT_EVENTS() takes 1 to PTK_MAX_WAIT_EVENTS events");
+    }
+  };
 
   class Event {
     friend class ptk::Kernel;
 
     I2List<Thread> waiting;
 
+    // the PTK_WAIT_EVENTS() waiting on this one among others, in the same
+    // order as waiting
+    I2List<EventWaitNode> selecting;
+
+    // filled in by Kernel::post_event(), which runs without the kernel lock
+    volatile eventmask_t posted_mask;
+    volatile uint8_t posted;
+    Event *posted_next;
+
+#if defined(PTK_LAZY_BROADCAST)
+    // Threads moved to the ready list by a broadcast keep waiting_for until
+    // they are taken to run, so the event must outlive that. Those whose
+    // wait_seq differs from broadcast_seq are no longer on the wait list.
+    uint16_t waiter_count;
+    uint16_t lazy_pending;
+    uint8_t broadcast_seq;
+    eventmask_t broadcast_mask;
+#if defined(PTK_WAKEUP_LATENCY)
+    uint32_t broadcast_at;
+#endif
+#endif
+
+    // threads on any core can wait on or signal the same event
+#if defined(PTK_MULTICORE)
+    CoreLock lock;
+    void lock_waiters() { lock.acquire(); }
+    void unlock_waiters() { lock.release(); }
+#else
+    void lock_waiters() {}
+    void unlock_waiters() {}
+#endif
+
   public:
     eventmask_t mask;
-  Event() : waiting(&Thread::ready_link) {}
+
+#if defined(PTK_WAKEUP_LATENCY)
+    // how long the threads this event woke waited to run
+    LatencyHistogram latency;
+    Event *next_registered_event;
+
+    Event();
+    ~Event();
+#else
+    Event() :
+      waiting(&Thread::ready_link), selecting(&EventWaitNode::link),
+      posted_mask(0), posted(0), posted_next(0)
+#if defined(PTK_LAZY_BROADCAST)
+      , waiter_count(0), lazy_pending(0), broadcast_seq(0), broadcast_mask(0)
+#endif
+    {}
+#endif
+  };
+
+  enum {
+    FLAGS_ANY   = 0,
+    FLAGS_ALL   = 1 << 0,
+    FLAGS_CLEAR = 1 << 1
   };
+
+  /**
+   * @class EventGroup
+   * @brief Word of 32 flags that threads wait on with PTK_FLAGS_WAIT()
+   *
+   * One thread can wait for several conditions at once, say rx ready and
+   * tx space, by giving each its own bit. Kernel::flags_set() wakes every
+   * waiter that the new flags satisfy, in priority order. All of them see
+   * the same flags, and the FLAGS_CLEAR waiters' bits are cleared once
+   * they have all been checked. Set flags from an interrupt handler
+   * between lock_from_isr() and unlock_from_isr().
+   */
+  class EventGroup {
+    friend class ptk::Kernel;
+
+    Event waiters;
+    uint32_t flags;
+
+  public:
+    EventGroup(uint32_t initial = 0) : flags(initial) {}
+
+    uint32_t value() const { return flags; }
+  };
+
+#if defined(PTK_WAKEUP_LATENCY)
+  // every Event, so that the shell can find their histograms
+  extern Event *all_registered_events;
+
+  inline Event::Event() :
+    waiting(&Thread::ready_link), selecting(&EventWaitNode::link),
+    posted_mask(0), posted(0), posted_next(0)
+#if defined(PTK_LAZY_BROADCAST)
+    , waiter_count(0), lazy_pending(0), broadcast_seq(0), broadcast_mask(0), broadcast_at(0)
+#endif
+  {
+    next_registered_event = all_registered_events;
+    all_registered_events = this;
+  }
+
+  inline Event::~Event() {
+#if defined(PTK_LAZY_BROADCAST)
+    PTK_ASSERT(lazy_pending == 0, "Event destroyed before the threads it woke ran.");
+#endif
+    Event **e = &all_registered_events;
+    while (*e != this) e = &(*e)->next_registered_event;
+    *e = next_registered_event;
+  }
+#endif
 }
@@ -0,0 +1,67 @@
+#pragma once
+
+#include "ptk/config.h"
+#include <stdint.h>
+
+namespace ptk {
+#if defined(PTK_WAKEUP_LATENCY)
+  /**
+   * @class LatencyHistogram
+   * @brief counts samples in power-of-two buckets
+   *
+   * Bucket 0 holds samples below 2, and bucket n holds samples from 2^n up
+   * to 2^(n+1) - 1. The last bucket also takes everything larger. Adding a
+   * sample costs a count-leading-zeros and an increment.
+   */
+  class LatencyHistogram {
+  public:
+    enum {
+      BUCKETS = PTK_LATENCY_BUCKETS
+    };
+
+    LatencyHistogram() { reset(); }
+
+    void add(uint32_t sample) {
+      unsigned n = sample < 2 ? 0 : 31 - __builtin_clz(sample);
+      if (n >= BUCKETS) n = BUCKETS - 1;
+#if defined(PTK_MULTICORE)
+      // threads on several cores can wake through the same event
+      __atomic_fetch_add(&buckets[n], 1, __ATOMIC_RELAXED);
+#else
+      buckets[n] = buckets[n] + 1;
+#endif
+    }
+
+    void reset() {
+      for (unsigned n=0; n < BUCKETS; ++n) buckets[n] = 0;
+    }
+
+    uint32_t bucket(unsigned n) const { return buckets[n]; }
+
+    uint32_t count() const {
+      uint32_t total = 0;
+      for (unsigned n=0; n < BUCKETS; ++n) total += buckets[n];
+      return total;
+    }
+
+    /**
+     * @brief finds the bucket that holds the given fraction of the samples
+     * @param[in] permille fraction of the samples, in thousandths
+     * @returns the lowest n such that buckets 0 to n hold at least that
+     *          many samples, or BUCKETS - 1 if there are none
+     */
+    unsigned percentile(unsigned permille) const {
+      uint64_t wanted = (uint64_t) count() * permille;
+      uint64_t seen = 0;
+      for (unsigned n=0; n < BUCKETS; ++n) {
+        seen += (uint64_t) buckets[n] * 1000;
+        if (seen >= wanted && seen != 0) return n;
+      }
+      return BUCKETS - 1;
+    }
+
+  private:
+    volatile uint32_t buckets[BUCKETS];
+  };
+#endif
+}
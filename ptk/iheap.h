@@ -0,0 +1,126 @@
+#pragma once
+
+#include "ptk/assert.h"
+#include <stdint.h>
+
+/*
+ * This file contains an "intrusive" binary min-heap. Like the intrusive
+ * lists in ilist.h, the bookkeeping lives in the elements themselves: each
+ * element holds its current position in the heap. That lets remove() and
+ * update() find an arbitrary element without searching, so every operation
+ * costs O(log n). The heap itself is a fixed array of N pointers, so it
+ * never allocates.
+ */
+namespace ptk {
+  struct IHeapLink {
+    enum { NONE = 0xffff };
+    uint16_t index;
+
+    IHeapLink() : index(NONE) { }
+  };
+
+  typedef IHeapLink iheaplink_t;
+
+  /*
+   * Before is a function object. Before()(a, b) returns true when a must
+   * leave the heap ahead of b.
+   */
+  template<typename T, unsigned N, typename Before>
+  class IHeap {
+    T *elements[N];
+    unsigned count;
+    IHeapLink T::*const member;
+    Before before;
+
+    IHeapLink &link(T &element) const {
+      return element.*member;
+    }
+
+    void place(unsigned i, T &element) {
+      elements[i] = &element;
+      link(element).index = i;
+    }
+
+    void sift_up(unsigned i) {
+      T *element = elements[i];
+      while (i > 0) {
+        unsigned parent = (i - 1) / 2;
+        if (!before(*element, *elements[parent])) break;
+        place(i, *elements[parent]);
+        i = parent;
+      }
+      place(i, *element);
+    }
+
+    void sift_down(unsigned i) {
+      T *element = elements[i];
+      for (;;) {
+        unsigned child = 2*i + 1;
+        if (child >= count) break;
+        if (child + 1 < count && before(*elements[child + 1], *elements[child])) child++;
+        if (!before(*elements[child], *element)) break;
+        place(i, *elements[child]);
+        i = child;
+      }
+      place(i, *element);
+    }
+
+  public:
+    IHeap(IHeapLink T::*m) : count(0), member(m) {}
+
+    bool empty() const {
+      return count == 0;
+    }
+
+    unsigned size() const {
+      return count;
+    }
+
+    bool contains(T &element) const {
+      unsigned i = link(element).index;
+      return i < count && elements[i] == &element;
+    }
+
+    // the element that pop() would return, without removing it
+    T *front() const {
+      return count ? elements[0] : 0;
+    }
+
+    void push(T &element) {
+      PTK_ASSERT(count < N, "IHeap is full.");
+      place(count, element);
+      sift_up(count++);
+    }
+
+    T *pop() {
+      if (empty()) return 0;
+
+      T *value = elements[0];
+      remove(*value);
+      return value;
+    }
+
+    // does nothing if element isn't in the heap
+    void remove(T &element) {
+      if (!contains(element)) return;
+
+      unsigned i = link(element).index;
+      link(element).index = IHeapLink::NONE;
+      if (i == --count) return;
+
+      // move the last element into the hole, then restore the order
+      T *moved = elements[count];
+      place(i, *moved);
+      sift_up(i);
+      sift_down(link(*moved).index);
+    }
+
+    // restores the order after the key of element has changed
+    void update(T &element) {
+      if (!contains(element)) return;
+
+      sift_up(link(element).index);
+      sift_down(link(element).index);
+    }
+  };
+}
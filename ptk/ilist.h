@@ -213,6 +213,47 @@ namespace ptk {
       }
     }
 
+    // add in front of position, which must already be in the list
+    void insert_before(T &elt, T &position) {
+      link(elt).join_left_of(link(position));
+      if (ring == &link(position)) ring = &link(elt);
+    }
+
+    // moves every element of other to the back of this list, in O(1). Both
+    // lists must link through the same member.
+    void splice_back(I2List &other) {
+      if (other.ring == 0) return;
+
+      if (ring) {
+        I2Link *last = ring->left;
+        I2Link *other_last = other.ring->left;
+        last->right = other.ring;
+        other.ring->left = last;
+        other_last->right = ring;
+        ring->left = other_last;
+      } else {
+        ring = other.ring;
+      }
+      other.ring = 0;
+    }
+
+    // the element following elt, or 0 when elt is last or not in a list
+    T *next(T &elt) const {
+      I2Link &lnk = link(elt);
+      if (!lnk.is_joined() || lnk.right == ring) return 0;
+      return &element(*lnk.right);
+    }
+
+    // peek at the front
+    T *front() const {
+      return empty() ? 0 : &element(*ring);
+    }
+
+    // peek at the back
+    T *back() const {
+      return empty() ? 0 : &element(*ring->left);
+    }
+
     // remove from the front
     T *pop() {
       if (empty()) return 0;
@@ -27,6 +27,11 @@ namespace ptk {
   class DeviceInStream : public InStream {
   protected:
     FIFO<uint8_t> fifo;
+
+    // Called by the driver, usually from its interrupt handler, once it has
+    // put bytes in the fifo. not_empty is posted rather than broadcast, so
+    // the handler needn't lock the kernel, and a waiting reader wakes when
+    // the kernel next takes posted events, before its next dispatch.
     void device_wrote_to_fifo();
 
   public:
@@ -40,6 +45,8 @@ namespace ptk {
   class DeviceOutStream : public OutStream {
   protected:
     FIFO<uint8_t> fifo;
+
+    // the same for a driver that has taken bytes out, and not_full
     void device_read_from_fifo();
 
   public:
@@ -99,7 +106,7 @@ namespace ptk {
   { }
 
   inline void DeviceInStream::device_wrote_to_fifo() {
-    if (fifo.read_capacity() > 0) broadcast_event(not_empty, 0);
+    if (fifo.read_capacity() > 0) post_event(not_empty, 0);
   }
 
   inline DeviceOutStream::DeviceOutStream(uint8_t *fifo_storage, size_t fifo_size) :
@@ -107,6 +114,6 @@ namespace ptk {
   { }
 
   inline void DeviceOutStream::device_read_from_fifo() {
-    if (fifo.write_capacity() > 0) broadcast_event(not_full, 0);
+    if (fifo.write_capacity() > 0) post_event(not_full, 0);
   }
 }
@@ -1,60 +1,381 @@
 #include "ptk/assert.h"
 #include "ptk/kernel.h"
+#include "ptk/pool.h"
+#include "ptk/port.h"
 
 using namespace ptk;
 
+/*
+ * The critical section normally comes from the port layer. Defining these
+ * two macros still overrides it.
+ */
 #if !defined(PTK_PORT_DISABLE_INTERRUPTS)
-#define PTK_PORT_DISABLE_INTERRUPTS asm volatile ("cpsid i")
-#else
-#define PTK_PORT_DISABLE_INTERRUPS while (0) {}
+#define PTK_PORT_DISABLE_INTERRUPTS ptk::port::disable_interrupts()
 #endif
 
 #if !defined(PTK_PORT_ENABLE_INTERRUPTS)
-#define PTK_PORT_ENABLE_INTERRUPTS asm volatile ("cpsie i")
+#define PTK_PORT_ENABLE_INTERRUPTS ptk::port::enable_interrupts()
+#endif
+
+#if defined(PTK_TRACE)
+#define KERNEL_TRACE(kind, object, arg) tracer.record(trace::kind, (object), (arg))
+#else
+#define KERNEL_TRACE(kind, object, arg)
+#endif
+
+#if defined(PTK_THREAD_STATS)
+#define KERNEL_NOTE_WAKEUP(thread, reason, event) note_wakeup((thread), (reason), (event))
 #else
-#define PTK_PORT_ENABLE_INTERRUPS while (0) {}
+#define KERNEL_NOTE_WAKEUP(thread, reason, event)
 #endif
 
-Kernel *ptk::the_kernel = 0;
+PTK_CORE_LOCAL Kernel *ptk::the_kernel = 0;
+
+#if defined(PTK_WAKEUP_LATENCY)
+Event *ptk::all_registered_events = 0;
+#endif
+
+// for every PTK_WAIT_EVENTS() on every core
+static Pool<EventWaitNode, PTK_WAIT_NODES> event_wait_nodes;
+
+#if defined(PTK_MULTICORE)
+static Kernel *cores[PTK_MAX_CORES];
+static CoreLock cores_lock;
+
+// one bit per core that is sleeping in its idle hook
+static volatile uint32_t idle_cores = 0;
+#endif
 
 Kernel::Kernel() :
-ready_list(&Thread::ready_link),
+#if defined(PTK_EDF)
+  ready_heap(&Thread::ready_heap_link),
+  ready_seq(0),
+#else
+  ready_levels(0),
+#endif
+#if !defined(PTK_TIMER_WHEEL)
   armed_timers(&Timer::timer_link),
+  clock(0),
+#endif
+#if !defined(PTK_TIMER_WHEEL) && !defined(PTK_TIMER_SORTED_LIST)
+  earliest_deadline((uint64_t) -1),
+#endif
+  expiring(0),
   active_thread(0),
+  idle_hook(0),
+  batch_count(0),
   isr_depth(0),
-  lock_depth(0)
+  lock_depth(0),
+#if defined(PTK_THREAD_STATS)
+  cycle_counter(&port::timestamp),
+#endif
+#if defined(PTK_RUN_BUDGET)
+  run_budget(PTK_RUN_BUDGET),
+  overrun_hook(0),
+  latest_overrun(),
+  overrun_count(0),
+#endif
+  posted_head(0),
+  deferred_head(0)
+#if defined(PTK_MULTICORE)
+  , remote_head(0),
+  core_id(-1)
+#endif
 {}
 
 void Kernel::schedule(Thread &t) {
   PTK_ASSERT(lock_depth > 0,
              "Kernel must be locked to schedule a thread.");
-  // add t to the end of the ready list
-  ready_list.push_back(t);
+#if defined(PTK_MULTICORE)
+  // a thread stays on the core that last ran it
+  if (t.home == 0) t.home = this;
+  if (t.home != this) {
+    t.home->post_remote(t);
+    return;
+  }
+
+  // more ready threads than this core can run, so wake a core to steal some
+  if (idle_cores != 0 && (ready_levels != 0 || active_thread != 0)) give_away();
+#endif
+#if defined(PTK_EDF)
+  // the deadline counts from the moment the thread becomes ready
+  t.deadline = (ptk_time_t) ticks() + t.relative_deadline;
+  push_ready(t);
+#else
+  // add t to the end of the ready list for its priority
+  ready_list[t.priority].push_back(t);
+  ready_levels |= 1u << t.priority;
+#endif
+}
+
+// puts back a thread that has run and is still runnable
+void Kernel::reschedule(Thread &t) {
+#if defined(PTK_EDF)
+  // it's still working towards the same deadline
+  push_ready(t);
+#else
+  schedule(t);
+#endif
+}
+
+#if defined(PTK_EDF)
+bool Kernel::ReadyOrder::operator()(const Thread &a, const Thread &b) const {
+  if (a.priority != b.priority) return a.priority > b.priority;
+
+  bool a_has = a.relative_deadline != TIME_INFINITE;
+  bool b_has = b.relative_deadline != TIME_INFINITE;
+  if (a_has != b_has) return a_has;
+
+  // the low half of the clock may wrap
+  if (a_has && a.deadline != b.deadline) return time_before(a.deadline, b.deadline);
+  return time_before(a.ready_seq, b.ready_seq);
 }
 
+void Kernel::push_ready(Thread &t) {
+  t.ready_seq = ready_seq++;
+  ready_heap.push(t);
+}
+#endif
+
 void Kernel::wakeup(Thread &t, wakeup_t reason) {
   PTK_ASSERT(lock_depth > 0,
              "Kernel must be locked to wakeup a thread.");
   t.wakeup_reason = reason;
-  ready_list.push_back(t);
+  KERNEL_TRACE(WAKEUP, &t, reason);
+  KERNEL_NOTE_WAKEUP(t, reason, 0);
+  schedule(t);
 }
 
 void Kernel::wait_subthread(Thread &parent, SubThread &sub, ptk_time_t duration) {
+  SubThread *subs[1] = { &sub };
+  wait_subthreads(parent, subs, 1, 1, duration);
+}
+
+void Kernel::wait_subthreads(Thread &parent, SubThread *const subs[], unsigned count,
+                             unsigned needed, ptk_time_t duration) {
   PTK_ASSERT(lock_depth > 0,
              "Kernel must be locked to wait on a subthread.");
+  PTK_ASSERT(needed > 0 && needed <= count && count < 0x10000,
+             "Bad number of subthreads to wait for.");
   unschedule(parent);
   if (duration < TIME_INFINITE) arm_timer(parent, duration);
-  sub.reset();
-  sub.parent = &parent;
-  schedule(sub);
+
+  // the parent isn't waiting on anything else, so no subthread can finish
+  // against the old join while the new one starts
+  uint16_t seq = (parent.join_state >> 16) + 1;
+  parent.join_state = ((uint32_t) seq << 16) | needed;
+
+  for (unsigned i=0; i < count; ++i) {
+    SubThread &sub = *subs[i];
+    PTK_ASSERT(sub.held_mutexes == 0, "Subthread restarted while holding a mutex.");
+#if defined(PTK_MULTICORE)
+    PTK_ASSERT(sub.state & (INIT_STATE | FINAL_STATE) || sub.home == 0 || sub.home == this,
+               "Subthread restarted while it runs on another core.");
+#endif
+
+    // one left running by an earlier join starts over
+    withdraw(sub);
+    sub.reset();
+    sub.parent = &parent;
+    sub.join_seq = seq;
+    schedule(sub);
+  }
+}
+
+void Kernel::subthread_done(SubThread &sub) {
+  PTK_ASSERT(lock_depth > 0,
+             "Kernel must be locked to finish a subthread.");
+  Thread &parent = *sub.parent;
+  sub.parent = 0;
+
+  // subthreads can finish on other cores, and the parent's timer can race
+  // them, so the count only goes down while the join is still current
+  uint32_t old_state = parent.join_state, new_state;
+  do {
+    if ((old_state >> 16) != sub.join_seq || (old_state & 0xffff) == 0) return;
+    new_state = old_state - 1;
+  } while (!__atomic_compare_exchange_n(&parent.join_state, &old_state, new_state, true,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+
+  if ((new_state & 0xffff) == 0) wakeup(parent, WAKEUP_SUBTHREAD_DONE);
+}
+
+bool Kernel::cancel_join(Thread &t) {
+  uint32_t old_state = t.join_state;
+  do {
+    if ((old_state & 0xffff) == 0) return false;
+  } while (!__atomic_compare_exchange_n(&t.join_state, &old_state, old_state & ~0xffffu, true,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+  return true;
+}
+
+void Kernel::unregister_thread(Thread &t) {
+  lock();
+  PTK_ASSERT(&t != active_thread, "A thread can't destroy itself while it runs.");
+  PTK_ASSERT(t.held_mutexes == 0, "Thread destroyed while holding a mutex.");
+#if defined(PTK_MULTICORE)
+  PTK_ASSERT(t.home == 0 || t.home == this, "Thread destroyed on another core.");
+#endif
+
+  withdraw(t);
+
+  // run() mustn't dispatch it or put it back
+  for (unsigned i=0; i < batch_count; ++i) {
+    if (batch[i] == &t) batch[i] = 0;
+  }
+  unlock();
+}
+
+// takes t off its timer, whatever it waits on, and the ready list
+void Kernel::withdraw(Thread &t) {
+  // off the wait list first, because it shares ready_link with the ready list
+  if (t.timer_expiration != TIME_NEVER) disarm_timer(t);
+  cancel_wait(t);
+  cancel_wait_events(t);
+  cancel_join(t);
+  unschedule(t);
 }
 
 void Kernel::unschedule(Thread &t) {
   PTK_ASSERT(lock_depth > 0,
              "Kernel must be locked to unschedule a thread.");
-  ready_list.remove(t);
+#if defined(PTK_EDF)
+  ready_heap.remove(t);
+#else
+  ThreadList &list = ready_list[t.priority];
+  list.remove(t);
+  if (list.empty()) ready_levels &= ~(1u << t.priority);
+#endif
+}
+
+// whether t is on a ready list, waiting to run
+inline bool Kernel::is_ready(Thread &t) {
+#if defined(PTK_EDF)
+  return ready_heap.contains(t);
+#else
+  // a thread alone on its list isn't joined to anything
+  return t.ready_link.is_joined() || ready_list[t.priority].front() == &t;
+#endif
+}
+
+Thread *Kernel::next_ready() {
+#if defined(PTK_EDF)
+  return ready_heap.pop();
+#else
+  if (ready_levels == 0) return 0;
+
+  // the highest priority level with a thread that's ready to run
+  unsigned level = 31 - __builtin_clz(ready_levels);
+  ThreadList &list = ready_list[level];
+  Thread *t = list.pop();
+  if (list.empty()) ready_levels &= ~(1u << level);
+  return t;
+#endif
+}
+
+#if defined(PTK_MULTICORE)
+
+void Kernel::attach_core() {
+  cores_lock.acquire();
+  for (int i=0; i < PTK_MAX_CORES; ++i) {
+    if (cores[i] == 0) {
+      cores[i] = this;
+      core_id = i;
+      break;
+    }
+  }
+  cores_lock.release();
+  PTK_ASSERT(core_id >= 0, "More than PTK_MAX_CORES kernels attached.");
+}
+
+void Kernel::detach_core() {
+  cores_lock.acquire();
+  cores[core_id] = 0;
+  core_id = -1;
+  cores_lock.release();
+}
+
+void Kernel::post_remote(Thread &t) {
+  // Treiber stack push. Only the owning core ever takes from it.
+  Thread *head = __atomic_load_n(&remote_head, __ATOMIC_RELAXED);
+  do {
+    t.remote_next = head;
+  } while (!__atomic_compare_exchange_n(&remote_head, &head, &t, true,
+                                        __ATOMIC_SEQ_CST, __ATOMIC_RELAXED));
+
+  // claim the idle bit, so that only one waker sends the interrupt
+  const uint32_t bit = 1u << core_id;
+  if (__atomic_fetch_and(&idle_cores, ~bit, __ATOMIC_SEQ_CST) & bit) {
+    port::wake_core(core_id);
+  }
+}
+
+void Kernel::take_remote() {
+  Thread *t = __atomic_exchange_n(&remote_head, (Thread *) 0, __ATOMIC_ACQUIRE);
+
+  // the stack holds the newest first, so reverse it to keep wakeups in order
+  Thread *fifo = 0;
+  while (t) {
+    Thread *next = t->remote_next;
+    t->remote_next = fifo;
+    fifo = t;
+    t = next;
+  }
+
+  while ((t = fifo)) {
+    fifo = t->remote_next;
+    t->remote_next = 0;
+    ready_list[t->priority].push_back(*t);
+    ready_levels |= 1u << t->priority;
+  }
+}
+
+void Kernel::give_away() {
+  uint32_t idle = __atomic_load_n(&idle_cores, __ATOMIC_RELAXED);
+  while (idle) {
+    unsigned core = __builtin_ctz(idle);
+    if (__atomic_compare_exchange_n(&idle_cores, &idle, idle & ~(1u << core), true,
+                                    __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+      port::wake_core(core);
+      return;
+    }
+  }
 }
 
+Thread *Kernel::steal() {
+  for (int i=1; i < PTK_MAX_CORES; ++i) {
+    Kernel *victim = cores[(core_id + i) % PTK_MAX_CORES];
+
+    // peek without the lock first, so idle cores don't fight over empty ones
+    if (victim == 0 || __atomic_load_n(&victim->ready_levels, __ATOMIC_RELAXED) == 0) continue;
+    if (!victim->core_lock.try_acquire()) continue;
+
+    // Take the newest thread at the victim's highest level. Threads with an
+    // armed timer stay put, because the timer lives on the victim's queue.
+    Thread *t = 0;
+    if (victim->ready_levels != 0) {
+      unsigned level = 31 - __builtin_clz(victim->ready_levels);
+      ThreadList &list = victim->ready_list[level];
+      Thread *candidate = list.back();
+      if (candidate != victim->active_thread &&
+          candidate->timer_expiration == TIME_NEVER) {
+        list.remove(*candidate);
+        if (list.empty()) victim->ready_levels &= ~(1u << level);
+
+        // moved under the victim's lock, so that its run() sees the move
+        candidate->home = this;
+        t = candidate;
+      }
+    }
+    victim->core_lock.release();
+
+    if (t) return t;
+  }
+  return 0;
+}
+
+#endif // defined(PTK_MULTICORE)
+
 bool Kernel::timer_is_armed(const Timer &t) {
   PTK_ASSERT(lock_depth > 0,
              "Kernel must be locked to test if a timer is armed.");
@@ -71,8 +392,8 @@ void Kernel::lock() {
   PTK_ASSERT(lock_depth < 1,
              "Kernel::lock() called while already locked.");
   PTK_PORT_DISABLE_INTERRUPTS;
+  core_lock.acquire();
   lock_depth++;
-
 }
 
 void Kernel::unlock() {
@@ -83,6 +404,7 @@ void Kernel::unlock() {
              "Negative lock_depth. Kernel::unlock() called without\n"
              "matching Kernel::lock().");
   if (--lock_depth == 0) {
+    core_lock.release();
     PTK_PORT_ENABLE_INTERRUPTS;
   }
 }
@@ -97,6 +419,7 @@ void Kernel::lock_from_isr() {
   PTK_ASSERT(lock_depth < 1,
              "Kernel::lock_from_isr() called while already locked.");
   PTK_PORT_DISABLE_INTERRUPTS;
+  core_lock.acquire();
   lock_depth++;
 }
 
@@ -108,11 +431,14 @@ void Kernel::unlock_from_isr() {
              "Negative lock_depth. Kernel::unlock_from_isr() called without\n"
              "matching Kernel::lock_from_isr().");
   if (--lock_depth == 0) {
+    core_lock.release();
     PTK_PORT_ENABLE_INTERRUPTS;
   }
 }
 
 void Kernel::enter_isr() {
+  PTK_ASSERT(port::in_isr(),
+             "Kernel::enter_isr() called outside of an interrupt handler.");
   PTK_ASSERT(lock_depth == 0,
              "An interrupt occurred while the kernel was locked.\n"
              "Interrupts should have been disabled!");
@@ -120,82 +446,386 @@ void Kernel::enter_isr() {
              "Negative isr_depth. Kernel::leave_isr() called without\n"
              "matching Kernel::enter_isr().");
   isr_depth++;
+  KERNEL_TRACE(ISR_ENTER, 0, isr_depth);
 }
 
 void Kernel::leave_isr() {
   PTK_ASSERT(isr_depth > 0,
              "Negative isr_depth. Kernel::leave_isr() called without\n"
              "matching Kernel::enter_isr().");
+  KERNEL_TRACE(ISR_LEAVE, 0, isr_depth);
   --isr_depth;
 }
 
-void Kernel::arm_timer(Timer &t, ptk_time_t when) {
+void Kernel::arm_timer(Timer &t, ptk_time_t duration) {
   PTK_ASSERT(t.timer_expiration == TIME_NEVER,
              "Attempt to arm a Timer that is already armed.");
-  if (when < TIME_INFINITE) {
-    t.timer_expiration = when;
-    armed_timers.push(t);
+  if (&t == expiring) expiring = 0;
+  if (duration < TIME_INFINITE) {
+    KERNEL_TRACE(TIMER_ARM, &t, duration);
+    t.timer_expiration = duration;
+    t.timer_deadline = ticks() + duration;
+    file_timer(t);
   }
 }
 
+void Kernel::arm_timer_at(Timer &t, uint64_t when) {
+  PTK_ASSERT(t.timer_expiration == TIME_NEVER,
+             "Attempt to arm a Timer that is already armed.");
+  const uint64_t current = ticks();
+  PTK_ASSERT(when <= current || when - current < TIME_INFINITE,
+             "Timer deadline too far in the future.");
+  if (&t == expiring) expiring = 0;
+
+  const ptk_time_t duration = when > current ? (ptk_time_t) (when - current) : 0;
+  KERNEL_TRACE(TIMER_ARM, &t, duration);
+  t.timer_expiration = duration;
+  t.timer_deadline = when;
+  file_timer(t);
+}
+
+// adds an armed timer, with its deadline set, to the queue
+void Kernel::file_timer(Timer &t) {
+#if defined(PTK_TIMER_WHEEL)
+  armed_timers.insert_at(t, t.timer_deadline);
+#elif defined(PTK_TIMER_SORTED_LIST)
+  // after every timer due at the same time or earlier
+  for (auto i = armed_timers.iter(); i.more(); i.next()) {
+    if (t.timer_deadline < i->timer_deadline) {
+      armed_timers.insert_before(t, *i);
+      return;
+    }
+  }
+  armed_timers.push_back(t);
+#else
+  armed_timers.push(t);
+  if (t.timer_deadline < earliest_deadline) earliest_deadline = t.timer_deadline;
+#endif
+}
+
 void Kernel::disarm_timer(Timer &t) {
   armed_timers.remove(t);
   t.timer_expiration = TIME_NEVER;
 }
 
+uint64_t Kernel::now() const {
+  // a tick interrupt between the two halves of a 64-bit load would tear
+  // it, so read until two loads agree
+  const volatile uint64_t &clock_ref = ticks();
+  uint64_t t;
+  do {
+    t = clock_ref;
+  } while (t != clock_ref);
+  return t;
+}
+
+ptk_time_t Kernel::next_deadline() {
+  PTK_ASSERT(lock_depth > 0,
+             "Kernel must be locked to find the next deadline.");
+#if defined(PTK_TIMER_WHEEL)
+  return armed_timers.next_expiration();
+#else
+  Timer *nearest = armed_timers.front();
+#if !defined(PTK_TIMER_SORTED_LIST)
+  for (auto i = armed_timers.iter(); i.more(); i.next()) {
+    if (i->timer_deadline < nearest->timer_deadline) nearest = &*i;
+  }
+#endif
+  if (nearest == 0) return TIME_INFINITE;
+
+  // armed less than TIME_INFINITE ticks ahead, so the difference fits
+  const uint64_t when = nearest->timer_deadline;
+  return when > clock ? (ptk_time_t) (when - clock) : 0;
+#endif
+}
+
 void Kernel::expire_timers(uint32_t time_delta) {
   I2List<Timer> expired(&Timer::timer_link);
 
-  // phase 1: find the timers that have expired
+  // phase 1: find the timers that have expired. Their deadlines are
+  // absolute, so the ones still armed aren't touched.
   lock_from_isr();
-  for (auto i = armed_timers.iter(); i.more();) {
-    // Extract the Timer pointer from the iterator before (possibly) removing
-    // the timer from the queue. This avoids screwing up iterator.
-    Timer *t = &*i;
-
-    if (t->timer_expiration <= time_delta) {
-      // We want to tell the timer how much time has elapsed since it's
-      // actual expiration. However, the timer_expiration field is unsigned
-      // so we can't simply subtract the time_delta and save the result.
-      // Instead, we'll save (time_delta-now), which will be non-negative.
-      t->timer_expiration = time_delta - t->timer_expiration;
-      i.remove();
-      expired.push(*t);
-    } else if (t->timer_expiration < TIME_INFINITE) {
-      t->timer_expiration -= time_delta;
-      i.next();
+#if defined(PTK_TIMER_WHEEL)
+  // the wheel fills in timer_expiration the same way the scan below does
+  armed_timers.advance(time_delta, expired);
+#else
+  clock += time_delta;
+#if defined(PTK_TIMER_SORTED_LIST)
+  // only the timers at the head of the list can have expired
+  Timer *head;
+  while ((head = armed_timers.front()) && head->timer_deadline <= clock) {
+    armed_timers.pop();
+    head->timer_expiration = (ptk_time_t) (clock - head->timer_deadline);
+    expired.push_back(*head);
+  }
+#else
+  // Disarming leaves earliest_deadline where it was, so it may be early,
+  // never late. The scan finds the true one again.
+  if (clock >= earliest_deadline) {
+    earliest_deadline = (uint64_t) -1;
+    for (auto i = armed_timers.iter(); i.more();) {
+      // Extract the Timer pointer from the iterator before (possibly) removing
+      // the timer from the queue. This avoids screwing up iterator.
+      Timer *t = &*i;
+
+      if (t->timer_deadline <= clock) {
+        // tell the timer how much time has elapsed since its actual expiration
+        t->timer_expiration = (ptk_time_t) (clock - t->timer_deadline);
+        i.remove();
+        expired.push(*t);
+      } else {
+        if (t->timer_deadline < earliest_deadline) earliest_deadline = t->timer_deadline;
+        i.next();
+      }
     }
   }
+#endif
+#endif
   unlock_from_isr();
 
   // phase 2: call timer_expired() on each
   Timer *t;
-
-  int loop_count = 0;
   while ((t = expired.pop())) {
+    KERNEL_TRACE(TIMER_EXPIRE, t, t->timer_expiration);
+    expiring = t;
     t->timer_expired();
-    t->timer_expiration = TIME_NEVER;
-    loop_count += 1;
+
+    // a timer that armed itself again, like a PeriodicTimer, stays armed
+    if (expiring == t) t->timer_expiration = TIME_NEVER;
+    expiring = 0;
   }
 }
 
+void Kernel::insert_waiter(Thread &thread, Event &event) {
+#if defined(PTK_LAZY_BROADCAST)
+  if (thread.waiting_for) finish_broadcast(thread);
+#endif
+  // ready_link can only be on one list at a time
+  unschedule(thread);
+  thread.waiting_for = &event;
+#if defined(PTK_LAZY_BROADCAST)
+  thread.wait_seq = event.broadcast_seq;
+  event.waiter_count++;
+#endif
+
+  // waiters are kept in priority order, first come first served within a level
+  for (auto i = event.waiting.iter(); i.more(); i.next()) {
+    if (i->priority < thread.priority) {
+      event.waiting.insert_before(thread, *i);
+      return;
+    }
+  }
+  event.waiting.push_back(thread);
+}
+
+Thread *Kernel::pop_waiter(Event &event) {
+  Thread *thread = event.waiting.pop();
+  if (thread) remove_waiter(*thread, event);
+  return thread;
+}
+
+// bookkeeping for a thread that has just left event's wait list
+inline void Kernel::remove_waiter(Thread &thread, Event &event) {
+  thread.waiting_for = 0;
+#if defined(PTK_LAZY_BROADCAST)
+  event.waiter_count--;
+#else
+  (void) event;
+#endif
+}
+
+#if defined(PTK_LAZY_BROADCAST)
+// Finishes the wakeup of a thread that a broadcast moved to the ready list
+// with the rest of its wait list. Returns true if the thread is still
+// waiting on the list instead.
+bool Kernel::finish_broadcast(Thread &thread) {
+  Event *event = thread.waiting_for;
+  if (thread.wait_seq == event->broadcast_seq) return false;
+
+  thread.waiting_for = 0;
+  event->lazy_pending--;
+  thread.wakeup_reason |= event->broadcast_mask;
+  KERNEL_TRACE(WAKEUP, &thread, thread.wakeup_reason);
+  KERNEL_NOTE_WAKEUP(thread, WAKEUP_OK, event);
+#if defined(PTK_WAKEUP_LATENCY)
+  thread.woken_at = event->broadcast_at;
+#endif
+  return true;
+}
+#endif
+
+bool Kernel::cancel_wait(Thread &thread) {
+  PTK_ASSERT(lock_depth > 0,
+             "Kernel must be locked to cancel a wait.");
+  Event *event = thread.waiting_for;
+  if (event == 0) return false;
+#if defined(PTK_LAZY_BROADCAST)
+  if (finish_broadcast(thread)) return false;
+#endif
+
+  // check again with the lock held, in case another core's signal got there
+  event->lock_waiters();
+  bool waiting = (thread.waiting_for == event);
+  if (waiting) {
+    event->waiting.remove(thread);
+    remove_waiter(thread, *event);
+  }
+  event->unlock_waiters();
+
+  if (waiting && thread.blocked_on) {
+    // the owner may have been running at this thread's priority
+    Mutex *m = thread.blocked_on;
+    thread.blocked_on = 0;
+    if (m->owner) update_priority(*m->owner);
+  }
+  return waiting;
+}
+
 void Kernel::wait_event(Thread &thread, Event &event, ptk_time_t duration) {
   lock();
+  wait_event_locked(thread, event, duration);
+  unlock();
+}
+
+void Kernel::wait_event_locked(Thread &thread, Event &event, ptk_time_t duration) {
+  PTK_ASSERT(lock_depth > 0,
+             "Kernel must be locked to wait on an event.");
+  event.lock_waiters();
+  insert_waiter(thread, event);
+  event.unlock_waiters();
   if (duration != TIME_INFINITE) arm_timer(thread, duration);
+}
+
+void Kernel::wait_events(Thread &thread, const EventList &events, ptk_time_t duration) {
+  lock();
+  PTK_ASSERT(thread.wait_nodes == 0, "Thread is already waiting on several events.");
   unschedule(thread);
-  event.waiting.push_back(thread);
+  thread.fired = 0;
+
+  EventWaitNode *nodes = 0;
+  for (unsigned n=0; n < events.count; ++n) {
+    nodes = event_wait_nodes.create(thread, *events.events[n], nodes);
+    PTK_ASSERT(nodes, "Out of PTK_WAIT_NODES.");
+  }
+
+#if defined(PTK_MULTICORE)
+  // A signal on another core could otherwise wake the thread and free the
+  // nodes before they are all listed. Taking the locks in address order
+  // keeps two such waits from deadlocking.
+  Event *locked[PTK_MAX_WAIT_EVENTS];
+  for (unsigned n=0; n < events.count; ++n) {
+    unsigned i = n;
+    for (; i > 0 && locked[i-1] > events.events[n]; --i) locked[i] = locked[i-1];
+    locked[i] = events.events[n];
+  }
+  for (unsigned n=0; n < events.count; ++n) {
+    if (n == 0 || locked[n] != locked[n-1]) locked[n]->lock_waiters();
+  }
+#endif
+
+  thread.wait_nodes = nodes;
+  for (EventWaitNode *node = nodes; node; node = node->next) {
+    // in priority order, first come first served within a level, as on
+    // the event's wait list
+    I2List<EventWaitNode> &list = node->event->selecting;
+    EventWaitNode *position = list.front();
+    while (position && position->thread->priority >= thread.priority) {
+      position = list.next(*position);
+    }
+    if (position) {
+      list.insert_before(*node, *position);
+    } else {
+      list.push_back(*node);
+    }
+    node->listed = true;
+  }
+
+#if defined(PTK_MULTICORE)
+  for (unsigned n=0; n < events.count; ++n) {
+    if (n == 0 || locked[n] != locked[n-1]) locked[n]->unlock_waiters();
+  }
+#endif
+
+  if (duration != TIME_INFINITE) arm_timer(thread, duration);
   unlock();
 }
 
+// Takes the nodes of t's PTK_WAIT_EVENTS(). Only one caller gets them, so
+// only one event wakes t, even with signals on several cores at once.
+EventWaitNode *Kernel::claim_wait_nodes(Thread &t) {
+#if defined(PTK_MULTICORE)
+  return __atomic_exchange_n(&t.wait_nodes, (EventWaitNode *) 0, __ATOMIC_ACQ_REL);
+#else
+  EventWaitNode *nodes = t.wait_nodes;
+  t.wait_nodes = 0;
+  return nodes;
+#endif
+}
+
+// Pops the event's selecting list until a node wins its thread's wait,
+// and returns that thread with its nodes. The event's lock must be held.
+Thread *Kernel::pop_selecting(Event &event, EventWaitNode *&nodes) {
+  EventWaitNode *node;
+  while ((node = event.selecting.pop())) {
+    node->listed = false;
+    nodes = claim_wait_nodes(*node->thread);
+    if (nodes) return node->thread;
+  }
+  return 0;
+}
+
+// Takes the nodes of a finished wait off the events that didn't fire, and
+// frees them. No event lock may be held, since each node takes its own.
+void Kernel::release_wait_nodes(EventWaitNode *node) {
+  while (node) {
+    EventWaitNode *next = node->next;
+    Event &event = *node->event;
+    event.lock_waiters();
+    if (node->listed) event.selecting.remove(*node);
+    event.unlock_waiters();
+    event_wait_nodes.destroy(node);
+    node = next;
+  }
+}
+
+bool Kernel::cancel_wait_events(Thread &thread) {
+  PTK_ASSERT(lock_depth > 0,
+             "Kernel must be locked to cancel a wait.");
+  EventWaitNode *nodes = claim_wait_nodes(thread);
+  if (nodes == 0) return false;
+
+  release_wait_nodes(nodes);
+  return true;
+}
+
+inline void Kernel::wake_waiter(Thread &thread, Event &event, eventmask_t mask) {
+  thread.wakeup_reason |= mask;
+  KERNEL_TRACE(WAKEUP, &thread, thread.wakeup_reason);
+  KERNEL_NOTE_WAKEUP(thread, WAKEUP_OK, &event);
+  schedule(thread);
+}
+
 void Kernel::signal_event(Event &event, eventmask_t mask) {
   PTK_ASSERT(lock_depth > 0,
              "Kernel must be locked to signal an event.");
 
-  Thread *thread;
-  if ((thread = event.waiting.pop())) {
-    thread->wakeup_reason |= mask;
-    schedule(*thread);
+  // the highest priority waiter, whichever list it's on
+  Thread *thread = 0;
+  EventWaitNode *nodes = 0;
+  event.lock_waiters();
+  EventWaitNode *node = event.selecting.front();
+  if (node && (event.waiting.empty() || node->thread->priority > event.waiting.front()->priority)) {
+    thread = pop_selecting(event, nodes);
   }
+  if (thread == 0) thread = pop_waiter(event);
+  event.unlock_waiters();
+
+  KERNEL_TRACE(EVENT_SIGNAL, &event, mask);
+  if (nodes) {
+    release_wait_nodes(nodes);
+    thread->fired = &event;
+  }
+  if (thread) wake_waiter(*thread, event, mask);
 }
 
 void Kernel::broadcast_event(Event &event, eventmask_t mask) {
@@ -203,26 +833,534 @@ void Kernel::broadcast_event(Event &event, eventmask_t mask) {
              "Kernel must be locked to broadcast an event.");
 
   Thread *thread;
-  while ((thread = event.waiting.pop())) {
-    thread->wakeup_reason |= mask;
+  KERNEL_TRACE(EVENT_BROADCAST, &event, mask);
+  while (!event.selecting.empty()) {
+    EventWaitNode *nodes = 0;
+    event.lock_waiters();
+    thread = pop_selecting(event, nodes);
+    event.unlock_waiters();
+    if (thread == 0) break;
+
+    release_wait_nodes(nodes);
+    thread->fired = &event;
+    wake_waiter(*thread, event, mask);
+  }
+
+#if defined(PTK_LAZY_BROADCAST)
+  // Waiters of one priority can join the back of their ready list as they
+  // are. Each one's wakeup is finished when it is taken to run.
+  thread = event.waiting.front();
+  if (thread && event.lazy_pending == 0 && thread->priority == event.waiting.back()->priority) {
+    event.lazy_pending = event.waiter_count;
+    event.waiter_count = 0;
+    event.broadcast_seq++;
+    event.broadcast_mask = mask;
+#if defined(PTK_WAKEUP_LATENCY)
+    event.broadcast_at = cycle_counter();
+#endif
+    ready_list[thread->priority].splice_back(event.waiting);
+    ready_levels |= 1u << thread->priority;
+    return;
+  }
+#endif
+  event.lock_waiters();
+  while ((thread = pop_waiter(event))) wake_waiter(*thread, event, mask);
+  event.unlock_waiters();
+}
+
+bool Kernel::sem_wait(Thread &thread, Semaphore &sem, ptk_time_t duration) {
+  lock();
+  sem.waiters.lock_waiters();
+  bool taken = sem.count > 0;
+  bool blocks = !taken && duration != TIME_IMMEDIATE;
+  if (taken) {
+    sem.count--;
+  } else if (blocks) {
+    thread.state = WAIT_SEM_STATE;
+    insert_waiter(thread, sem.waiters);
+  }
+  sem.waiters.unlock_waiters();
+
+  if (blocks) {
+    if (duration != TIME_INFINITE) arm_timer(thread, duration);
+  } else {
+    thread.wakeup_reason = taken ? WAKEUP_OK : WAKEUP_TIMEOUT;
+  }
+  unlock();
+  return !blocks;
+}
+
+void Kernel::sem_signal(Semaphore &sem) {
+  PTK_ASSERT(lock_depth > 0,
+             "Kernel must be locked to signal a semaphore.");
+
+  sem.waiters.lock_waiters();
+  Thread *thread = pop_waiter(sem.waiters);
+  if (thread == 0) sem.count++;
+  sem.waiters.unlock_waiters();
+
+  if (thread) wakeup(*thread, WAKEUP_OK);
+}
+
+// whether flags satisfy a wait for bits
+static inline bool flags_match(uint32_t flags, uint32_t bits, uint8_t options) {
+  return (options & FLAGS_ALL) ? (flags & bits) == bits : (flags & bits) != 0;
+}
+
+bool Kernel::flags_wait(Thread &thread, EventGroup &g, uint32_t bits, uint8_t options,
+                        ptk_time_t duration) {
+  lock();
+  g.waiters.lock_waiters();
+  bool matched = flags_match(g.flags, bits, options);
+  bool blocks = !matched && duration != TIME_IMMEDIATE;
+  if (blocks) {
+    thread.state = WAIT_FLAGS_STATE;
+    thread.event_flags = bits;
+    thread.flags_options = options;
+    insert_waiter(thread, g.waiters);
+  } else {
+    thread.event_flags = g.flags;
+    if (matched && (options & FLAGS_CLEAR)) g.flags &= ~bits;
+  }
+  g.waiters.unlock_waiters();
+
+  if (blocks) {
+    if (duration != TIME_INFINITE) arm_timer(thread, duration);
+  } else {
+    thread.wakeup_reason = matched ? WAKEUP_OK : WAKEUP_TIMEOUT;
+  }
+  unlock();
+  return !blocks;
+}
+
+void Kernel::flags_set(EventGroup &g, uint32_t bits) {
+  PTK_ASSERT(lock_depth > 0,
+             "Kernel must be locked to set event flags.");
+
+  g.waiters.lock_waiters();
+  const uint32_t flags = (g.flags |= bits);
+  uint32_t clear = 0;
+  for (auto i = g.waiters.waiting.iter(); i.more();) {
+    Thread *thread = &*i;
+    if (!flags_match(flags, thread->event_flags, thread->flags_options)) {
+      i.next();
+      continue;
+    }
+
+    if (thread->flags_options & FLAGS_CLEAR) clear |= thread->event_flags;
+    i.remove();
+    remove_waiter(*thread, g.waiters);
+    thread->event_flags = flags;
+    thread->wakeup_reason = WAKEUP_OK;
+    KERNEL_TRACE(WAKEUP, thread, WAKEUP_OK);
+    KERNEL_NOTE_WAKEUP(*thread, WAKEUP_OK, &g.waiters);
     schedule(*thread);
   }
+  g.flags &= ~clear;
+  g.waiters.unlock_waiters();
+}
+
+void Kernel::flags_clear(EventGroup &g, uint32_t bits) {
+  PTK_ASSERT(lock_depth > 0,
+             "Kernel must be locked to clear event flags.");
+  g.waiters.lock_waiters();
+  g.flags &= ~bits;
+  g.waiters.unlock_waiters();
+}
+
+bool Kernel::mutex_lock(Thread &thread, Mutex &m, ptk_time_t duration) {
+  lock();
+  m.waiters.lock_waiters();
+  PTK_ASSERT(m.owner != &thread, "Mutex locked twice by the same thread.");
+  bool taken = (m.owner == 0);
+  bool blocks = !taken && duration != TIME_IMMEDIATE;
+  Thread *owner = m.owner;
+  if (taken) {
+    m.owner = &thread;
+    m.next_held = thread.held_mutexes;
+    thread.held_mutexes = &m;
+  } else if (blocks) {
+    thread.state = WAIT_MUTEX_STATE;
+    thread.blocked_on = &m;
+    insert_waiter(thread, m.waiters);
+  }
+  m.waiters.unlock_waiters();
+
+  if (blocks) {
+    if (duration != TIME_INFINITE) arm_timer(thread, duration);
+    if (owner->priority < thread.priority) update_priority(*owner);
+  } else {
+    thread.wakeup_reason = taken ? WAKEUP_OK : WAKEUP_TIMEOUT;
+  }
+  unlock();
+  return !blocks;
+}
+
+void Kernel::mutex_unlock(Thread &thread, Mutex &m) {
+  lock();
+  m.waiters.lock_waiters();
+  PTK_ASSERT(m.owner == &thread, "Mutex unlocked by a thread that doesn't hold it.");
+
+  Mutex **link = &thread.held_mutexes;
+  while (*link != &m) link = &(*link)->next_held;
+  *link = m.next_held;
+
+  Thread *next = pop_waiter(m.waiters);
+  m.owner = next;
+  if (next) {
+    next->blocked_on = 0;
+    m.next_held = next->held_mutexes;
+    next->held_mutexes = &m;
+  } else {
+    m.next_held = 0;
+  }
+  m.waiters.unlock_waiters();
+
+  // give up whatever was inherited through m, and pass it to the new owner
+  update_priority(thread);
+  if (next) {
+    update_priority(*next);
+    wakeup(*next, WAKEUP_OK);
+  }
+  unlock();
+}
+
+void Kernel::update_priority(Thread &thread) {
+  // Follow the chain of owners. It ends when a priority stays the same, so
+  // even a deadlocked cycle of mutexes stops once the priorities settle.
+  for (Thread *t = &thread; t != 0; ) {
+    priority_t p = t->base_priority;
+    for (Mutex *m = t->held_mutexes; m != 0; m = m->next_held) {
+      Thread *top = m->waiters.waiting.front();
+      if (top && top->priority > p) p = top->priority;
+    }
+    if (p == t->priority) return;
+
+    set_priority(*t, p);
+    t = t->blocked_on ? t->blocked_on->owner : 0;
+  }
+}
+
+void Kernel::set_priority(Thread &thread, priority_t priority) {
+#if defined(PTK_MULTICORE)
+  if (thread.home != 0 && thread.home != this) return;
+#endif
+  Event *event = thread.waiting_for;
+#if defined(PTK_LAZY_BROADCAST)
+  if (event && finish_broadcast(thread)) event = 0;
+#endif
+  if (event) {
+    // keep the wait list in priority order
+    event->lock_waiters();
+    event->waiting.remove(thread);
+    remove_waiter(thread, *event);
+    thread.priority = priority;
+    insert_waiter(thread, *event);
+    event->unlock_waiters();
+#if defined(PTK_EDF)
+  } else if (ready_heap.contains(thread)) {
+    thread.priority = priority;
+    ready_heap.update(thread);
+#else
+  } else if (is_ready(thread)) {
+    unschedule(thread);
+    thread.priority = priority;
+    ready_list[priority].push_back(thread);
+    ready_levels |= 1u << priority;
+#endif
+  } else {
+    thread.priority = priority;
+  }
+}
+
+void Kernel::post_event(Event &event, eventmask_t mask) {
+  KERNEL_TRACE(EVENT_POST, &event, mask);
+  __atomic_fetch_or(&event.posted_mask, mask, __ATOMIC_ACQ_REL);
+
+  // an event already in the queue picks up the new mask bits when it's taken
+  if (__atomic_exchange_n(&event.posted, 1, __ATOMIC_ACQ_REL)) return;
+
+  Event *head = __atomic_load_n(&posted_head, __ATOMIC_RELAXED);
+  do {
+    event.posted_next = head;
+  } while (!__atomic_compare_exchange_n(&posted_head, &head, &event, true,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+void Kernel::take_posted() {
+  Event *e = __atomic_exchange_n(&posted_head, (Event *) 0, __ATOMIC_ACQUIRE);
+
+  // the stack holds the newest first, so reverse it to broadcast in order
+  Event *fifo = 0;
+  while (e) {
+    Event *next = e->posted_next;
+    e->posted_next = fifo;
+    fifo = e;
+    e = next;
+  }
+
+  while ((e = fifo)) {
+    fifo = e->posted_next;
+
+    // Clear the flag before taking the mask. A post that lands in between
+    // queues the event again, rather than getting lost.
+    __atomic_store_n(&e->posted, 0, __ATOMIC_RELAXED);
+    eventmask_t mask = __atomic_exchange_n(&e->posted_mask, 0, __ATOMIC_ACQ_REL);
+    broadcast_event(*e, mask);
+  }
+}
+
+void Kernel::defer(DeferredCall &d) {
+  // already pending, so it will run anyway
+  if (__atomic_exchange_n(&d.deferred, 1, __ATOMIC_ACQ_REL)) return;
+
+  DeferredCall *head = __atomic_load_n(&deferred_head, __ATOMIC_RELAXED);
+  do {
+    d.deferred_next = head;
+  } while (!__atomic_compare_exchange_n(&deferred_head, &head, &d, true,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+void Kernel::run_deferred() {
+  DeferredCall *d;
+  while ((d = __atomic_exchange_n(&deferred_head, (DeferredCall *) 0, __ATOMIC_ACQUIRE))) {
+    // The stack holds the newest first. Inserting each call ahead of the
+    // ones with a lower or equal priority leaves the oldest first within a
+    // priority. There are only ever a few.
+    DeferredCall *sorted = 0;
+    while (d) {
+      DeferredCall *next = d->deferred_next;
+      DeferredCall **p = &sorted;
+      while (*p && (*p)->priority > d->priority) p = &(*p)->deferred_next;
+      d->deferred_next = *p;
+      *p = d;
+      d = next;
+    }
+
+    while ((d = sorted)) {
+      sorted = d->deferred_next;
+
+      // cleared first, so that a call deferred again while it runs isn't lost
+      __atomic_store_n(&d->deferred, 0, __ATOMIC_RELEASE);
+      d->call();
+    }
+  }
+}
+
+void Kernel::set_idle_hook(idle_hook_t hook) {
+  idle_hook = hook;
+}
+
+#if defined(PTK_THREAD_STATS)
+void Kernel::set_cycle_counter(cycle_counter_t counter) {
+  cycle_counter = counter;
+}
+#endif
+
+#if defined(PTK_RUN_BUDGET)
+void Kernel::set_run_budget(uint32_t cycles) {
+  run_budget = cycles;
+}
+
+void Kernel::set_overrun_hook(overrun_hook_t hook) {
+  overrun_hook = hook;
+}
+#endif
+
+#if defined(PTK_THREAD_STATS)
+void Kernel::note_wakeup(Thread &t, wakeup_t reason, Event *event) {
+#if defined(PTK_WAKEUP_LATENCY)
+  // a thread woken twice before it runs has waited since the first time
+  if (!t.woken) {
+    t.woken = true;
+    t.woken_at = cycle_counter();
+    t.woken_by = event;
+  }
+#endif
+
+  if (reason & WAKEUP_TIMEOUT) {
+    t.stats.wakeups_timeout++;
+  } else if (reason & WAKEUP_SUBTHREAD_DONE) {
+    t.stats.wakeups_subthread++;
+  } else {
+    t.stats.wakeups_ok++;
+  }
+}
+#endif
+
+void Kernel::take_wakeups() {
+  if (posted_head) take_posted();
+#if defined(PTK_MULTICORE)
+  if (remote_head) take_remote();
+#endif
+}
+
+Thread *Kernel::take_next() {
+  Thread *t = next_ready();
+#if defined(PTK_MULTICORE)
+  if (t == 0) t = steal();
+#endif
+#if defined(PTK_LAZY_BROADCAST)
+  if (t && t->waiting_for) finish_broadcast(*t);
+#endif
+  return t;
+}
+
+Thread *Kernel::idle() {
+#if defined(PTK_MULTICORE)
+  // Announce the sleep before the last look for work. A core that makes
+  // work for this one afterwards sees the bit and sends an interrupt.
+  Thread *t = 0;
+  const uint32_t bit = 1u << core_id;
+  __atomic_fetch_or(&idle_cores, bit, __ATOMIC_SEQ_CST);
+  if (__atomic_load_n(&remote_head, __ATOMIC_SEQ_CST) == 0 && (t = steal()) == 0) {
+    idle_hook(next_deadline());
+  }
+  __atomic_fetch_and(&idle_cores, ~bit, __ATOMIC_SEQ_CST);
+  return t;
+#else
+  // nothing to do until the next timer expires or an interrupt arrives
+  idle_hook(next_deadline());
+  return 0;
+#endif
+}
+
+// hands t to its reaper if it has just finished, outside the kernel lock
+inline void Kernel::reap(Thread &t) {
+  if (t.state == FINAL_STATE && t.reaper) t.reaper->reap(t);
+}
+
+// runs t once, outside the kernel lock
+inline void Kernel::dispatch(Thread &t) {
+  KERNEL_TRACE(DISPATCH_BEGIN, &t, 0);
+#if defined(PTK_RUN_BUDGET) && defined(PTK_DEBUG)
+  const char *from_file = t.debug_file;
+  const int from_line = t.debug_line;
+#endif
+#if defined(PTK_THREAD_STATS)
+  const uint32_t begin = cycle_counter();
+#if defined(PTK_WAKEUP_LATENCY)
+  if (t.woken) {
+    t.woken = false;
+    t.latency.add(begin - t.woken_at);
+    if (t.woken_by) t.woken_by->latency.add(begin - t.woken_at);
+  }
+#endif
+  t.run();
+  const uint32_t elapsed = cycle_counter() - begin;
+
+  t.stats.runs++;
+  t.stats.total_time += elapsed;
+  if (elapsed > t.stats.max_time) t.stats.max_time = elapsed;
+
+#if defined(PTK_RUN_BUDGET)
+  const uint32_t budget = t.run_budget ? t.run_budget : run_budget;
+  if (budget != 0 && elapsed > budget) {
+    KERNEL_TRACE(RUN_OVERRUN, &t, elapsed - budget);
+    t.stats.overruns++;
+    overrun_count++;
+    latest_overrun.thread = &t;
+    latest_overrun.cycles = elapsed - budget;
+#if defined(PTK_DEBUG)
+    latest_overrun.from_file = from_file;
+    latest_overrun.from_line = from_line;
+    latest_overrun.to_file = t.debug_file;
+    latest_overrun.to_line = t.debug_line;
+#endif
+    if (overrun_hook) overrun_hook(latest_overrun);
+  }
+#endif
+#else
+  t.run();
+#endif
+  KERNEL_TRACE(DISPATCH_END, &t, t.state);
 }
 
 bool Kernel::run_once() {
+  if (deferred_head) run_deferred();
+
   lock();
-  active_thread = ready_list.pop();
+  take_wakeups();
+  active_thread = take_next();
+
+  // a call deferred or an event posted after the checks above, by a handler
+  // the lock doesn't mask, mustn't wait out the idle
+  if (active_thread == 0 && idle_hook != 0 && deferred_head == 0 && posted_head == 0) {
+    active_thread = idle();
+  }
   unlock();
 
   if (active_thread) {
-    active_thread->run();
+    Thread &t = *active_thread;
+    dispatch(t);
 
+    // an interrupt during the run may have queued it already
     lock();
-    if (active_thread->state & RUNNABLE_STATES) schedule(*active_thread);
+    if ((t.state & RUNNABLE_STATES) && !is_ready(t)) reschedule(t);
     active_thread = 0;
     unlock();
+
+    reap(t);
     return true;
   } else {
     return false;
   }
 }
+
+unsigned Kernel::run(unsigned max_threads, uint32_t max_time) {
+  const uint32_t start = max_time ? port::timestamp() : 0;
+  unsigned dispatched = 0;
+
+  while (dispatched < max_threads) {
+    unsigned limit = max_threads - dispatched;
+    if (limit > PTK_RUN_BATCH) limit = PTK_RUN_BATCH;
+
+    if (deferred_head) run_deferred();
+
+    // one critical section to take the batch
+    lock();
+    take_wakeups();
+    unsigned count = 0;
+    while (count < limit && (batch[count] = take_next())) count++;
+    if (count == 0 && dispatched == 0 && idle_hook != 0 && deferred_head == 0 &&
+        posted_head == 0) {
+      if ((batch[0] = idle())) count = 1;
+    }
+    batch_count = count;
+    unlock();
+
+    if (count == 0) break;
+
+    for (unsigned i=0; i < count; ++i) {
+      if (batch[i] == 0) continue;
+      active_thread = batch[i];
+      dispatch(*active_thread);
+      dispatched++;
+    }
+    active_thread = 0;
+
+    // And one more to put back the threads that are still runnable. One
+    // that a later thread or an interrupt has woken is already queued.
+    lock();
+    for (unsigned i=0; i < count; ++i) {
+      Thread *t = batch[i];
+      if (t == 0 || !(t->state & RUNNABLE_STATES) || is_ready(*t)) continue;
+#if defined(PTK_MULTICORE)
+      // or stolen, and running on another core
+      if (t->home != this) continue;
+#endif
+      reschedule(*t);
+    }
+    unlock();
+
+    // a reaper may destroy its thread, which clears the entry
+    for (unsigned i=0; i < count; ++i) {
+      if (batch[i]) reap(*batch[i]);
+    }
+    batch_count = 0;
+
+    if (max_time != 0 && port::timestamp() - start >= max_time) break;
+  }
+
+  return dispatched;
+}
@@ -1,38 +1,308 @@
 #pragma once
 
+#include "ptk/atomic.h"
 #include "ptk/dqueue.h"
 #include "ptk/ilist.h"
 #include "ptk/timer.h"
 #include "ptk/event.h"
+#include "ptk/semaphore.h"
+#include "ptk/deferred.h"
+#include "ptk/trace.h"
 
 namespace ptk {
   class Thread;
   class Event;
 
+  /*
+   * Called by Kernel::run_once() or run() when no thread is ready and no
+   * deferred call or posted event is waiting, with the number of ticks
+   * until the next armed timer expires (TIME_INFINITE if there is none).
+   * The kernel is still locked, so an interrupt that readies a thread
+   * can't slip in between the check and the sleep. The hook should
+   * program a wakeup for the deadline and wait for an interrupt to become
+   * pending (WFI on Cortex-M works with interrupts masked). It must return
+   * with the kernel locked. Once the kernel unlocks, the pending interrupt
+   * runs, and the port reports the ticks that actually passed through
+   * expire_timers().
+   */
+  typedef void (*idle_hook_t)(ptk_time_t duration);
+
+  /*
+   * Free-running counter that times threads for PTK_THREAD_STATS. It's read
+   * twice around every dispatch, so it should be cheap. Only differences
+   * between readings are used, so it may wrap.
+   */
+  typedef uint32_t (*cycle_counter_t)();
+
+#if defined(PTK_RUN_BUDGET)
+  /*
+   * A dispatch that took longer than its thread's budget. The thread ran
+   * from the first location to the second, where it returned, so the
+   * culprit lies between the two.
+   */
+  struct Overrun {
+    Thread *thread;
+    uint32_t cycles;            // beyond the budget
+#if defined(PTK_DEBUG)
+    const char *from_file;
+    int from_line;
+    const char *to_file;
+    int to_line;
+#endif
+  };
+
+  /*
+   * Called by the Kernel after each overrun, without the kernel lock. It
+   * can log, count or halt, but the thread has already finished its run.
+   */
+  typedef void (*overrun_hook_t)(const Overrun &overrun);
+#endif
+
   class Kernel {
   protected:
-    I2List<Thread> ready_list;
+    struct ThreadList : public I2List<Thread> {
+      ThreadList() : I2List<Thread>(&Thread::ready_link) {}
+    };
+
+#if defined(PTK_EDF)
+    // highest priority first, then earliest deadline, then first come
+    struct ReadyOrder {
+      bool operator()(const Thread &a, const Thread &b) const;
+    };
+
+    IHeap<Thread, PTK_EDF_MAX_READY, ReadyOrder> ready_heap;
+    uint32_t ready_seq;
+
+    void push_ready(Thread &t);
+#else
+    // one FIFO per priority level, and a bit for each level that isn't empty
+    ThreadList ready_list[PTK_PRIORITY_LEVELS];
+    uint32_t ready_levels;
+#endif
+#if defined(PTK_TIMER_WHEEL)
+    // the wheel's clock is the kernel's
+    TimerWheel armed_timers;
+    const uint64_t &ticks() const { return armed_timers.now(); }
+#else
     I2List<Timer> armed_timers;
+
+    // ticks counted by expire_timers() since the kernel started
+    uint64_t clock;
+    const uint64_t &ticks() const { return clock; }
+#endif
+#if !defined(PTK_TIMER_WHEEL) && !defined(PTK_TIMER_SORTED_LIST)
+    // no armed timer expires before this, so ticks until then skip the scan
+    uint64_t earliest_deadline;
+#endif
+    void file_timer(Timer &t);
+    // the timer whose timer_expired() is running, until it arms itself again
+    Timer *expiring;
     Thread *active_thread;
+    idle_hook_t idle_hook;
+
+    // the threads run() has taken and not yet put back. A thread destroyed
+    // in the meantime leaves a null entry.
+    Thread *batch[PTK_RUN_BATCH];
+    unsigned batch_count;
+
+    Thread *next_ready();
+    bool is_ready(Thread &t);
+    void reschedule(Thread &t);
+    void dispatch(Thread &t);
+    void reap(Thread &t);
+    void withdraw(Thread &t);
+    Thread *take_next();
+    Thread *idle();
+    void take_wakeups();
+
+    // the wait list helpers expect the event's lock to be held
+    void insert_waiter(Thread &t, Event &e);
+    void remove_waiter(Thread &t, Event &e);
+#if defined(PTK_LAZY_BROADCAST)
+    bool finish_broadcast(Thread &t);
+#endif
+    Thread *pop_waiter(Event &e);
+    void wake_waiter(Thread &t, Event &e, eventmask_t mask);
+    EventWaitNode *claim_wait_nodes(Thread &t);
+    Thread *pop_selecting(Event &e, EventWaitNode *&nodes);
+    void release_wait_nodes(EventWaitNode *nodes);
+    void set_priority(Thread &t, priority_t priority);
+    void update_priority(Thread &t);
     volatile int16_t isr_depth;
     volatile int16_t lock_depth;
-      
+
+    // taken along with the interrupt mask, so that other cores stay out too
+    CoreLock core_lock;
+
+#if defined(PTK_TRACE)
+    trace::Buffer tracer;
+#endif
+
+#if defined(PTK_THREAD_STATS)
+    cycle_counter_t cycle_counter;
+    void note_wakeup(Thread &t, wakeup_t reason, Event *event);
+#endif
+
+#if defined(PTK_RUN_BUDGET)
+    uint32_t run_budget;
+    overrun_hook_t overrun_hook;
+    Overrun latest_overrun;
+    uint32_t overrun_count;
+#endif
+
+    // events posted by interrupt handlers, pushed lock-free, newest first
+    Event *volatile posted_head;
+    void take_posted();
+
+    // and deferred calls, the same way
+    DeferredCall *volatile deferred_head;
+    void run_deferred();
+
+#if defined(PTK_MULTICORE)
+    // threads woken by other cores, pushed lock-free, newest first
+    Thread *volatile remote_head;
+    int8_t core_id;
+
+    void post_remote(Thread &t);
+    void take_remote();
+    Thread *steal();
+    void give_away();
+#endif
+
   public:
     Kernel();
 
+#if defined(PTK_MULTICORE)
+    /**
+     * @brief makes this kernel one of the cores
+     *
+     * Call this from the worker that will run the kernel. Set the_kernel
+     * first, and start the port afterwards. From then on, other cores can
+     * wake this kernel's threads and steal from its ready lists.
+     */
+    void attach_core();
+
+    /**
+     * @brief removes this kernel from the cores
+     *
+     * No other core may be running while this is called.
+     */
+    void detach_core();
+
+    int core() const { return core_id; }
+#endif
+
+#if defined(PTK_TRACE)
+    trace::Buffer &trace_buffer() { return tracer; }
+#endif
+
+#if defined(PTK_THREAD_STATS)
+    /**
+     * @brief replaces port::timestamp() as the clock for thread statistics
+     *
+     * Cortex-M0 parts have no DWT cycle counter, for instance, so they can
+     * plug in a hardware timer here. Set it before any thread runs.
+     */
+    void set_cycle_counter(cycle_counter_t counter);
+    uint32_t cycles() const { return cycle_counter(); }
+#endif
+
+#if defined(PTK_RUN_BUDGET)
+    /**
+     * @brief sets the longest a run() may take, for threads without their own
+     * @param[in] cycles in cycle counter units, 0 to stop checking
+     */
+    void set_run_budget(uint32_t cycles);
+    void set_overrun_hook(overrun_hook_t hook);
+
+    // every dispatch that went over budget, and the last one, whose thread
+    // is 0 until there is one
+    uint32_t overruns() const { return overrun_count; }
+    const Overrun &last_overrun() const { return latest_overrun; }
+#endif
+
     void register_thread(Thread &t);
+
+    /**
+     * @brief takes a thread off every timer, wait list and ready list
+     *
+     * Thread's destructor calls this on the_kernel, so it's rarely needed
+     * directly. The thread must not be running or hold a mutex. With
+     * PTK_MULTICORE, it must be destroyed on the core it last ran on.
+     */
     void unregister_thread(Thread &t);
-    void arm_timer(Timer &t, ptk_time_t when);
+    void arm_timer(Timer &t, ptk_time_t duration);
+
+    /**
+     * @brief arms a timer to expire at an absolute tick from now()
+     *
+     * A deadline that has already passed expires on the next tick, and
+     * timer_expired() sees how late it is. Arming each period from the
+     * previous deadline rather than from the current time keeps a periodic
+     * loop from drifting. when must be less than TIME_INFINITE ticks away.
+     */
+    void arm_timer_at(Timer &t, uint64_t when);
     void disarm_timer(Timer &t);
+
+    /**
+     * @brief ticks counted by expire_timers() since the kernel started
+     *
+     * Safe to call without the kernel lock, from threads or interrupt
+     * handlers, even where a 64-bit load takes two instructions.
+     */
+    uint64_t now() const;
     bool timer_is_armed(const Timer &t);
+    ptk_time_t next_deadline();
 
     void schedule(Thread &t);
     void unschedule(Thread &t);
     void wait_subthread(Thread &parent, SubThread &sub, ptk_time_t duration);
+
+    /**
+     * @brief starts count subthreads and waits for needed of them to finish
+     *
+     * Use PTK_WAIT_ALL() or PTK_WAIT_ANY() rather than calling this
+     * directly. Each subthread that finishes counts down the parent's join,
+     * and the one that takes it to zero wakes the parent.
+     */
+    void wait_subthreads(Thread &parent, SubThread *const subs[], unsigned count,
+                         unsigned needed, ptk_time_t duration);
+
+    /**
+     * @brief counts a finished subthread against its parent's join
+     *
+     * SubThread::ptk_end() calls this with the kernel locked.
+     */
+    void subthread_done(SubThread &sub);
+
+    /**
+     * @brief ends t's join, so that its subthreads no longer wake it
+     * @returns false if the join was already over, because the last
+     *          subthread needed has woken t
+     */
+    bool cancel_join(Thread &t);
     void wakeup(Thread &t, wakeup_t reason);
 
     bool run_once();
+
+    /**
+     * @brief runs ready threads until none are left or the budget is spent
+     * @param[in] max_threads most threads to dispatch
+     * @param[in] max_time most time to spend, in port::timestamp() units,
+     *            or 0 for no limit. It's checked between batches.
+     * @returns the number of threads dispatched
+     *
+     * Threads are taken up to PTK_RUN_BATCH at a time, in the order
+     * run_once() would pick them, under a single lock. The still runnable
+     * ones go back under a second lock once the whole batch has run,
+     * unless something has readied them already. A thread readied in the
+     * meantime waits for the next batch, whatever its priority. A thread
+     * destroyed by another one in its batch is skipped. If nothing is
+     * ready at all, this idles like run_once().
+     */
+    unsigned run(unsigned max_threads, uint32_t max_time = 0);
     void expire_timers(uint32_t time_delta);
+    void set_idle_hook(idle_hook_t hook);
 
     void enter_isr();
     void lock_from_isr();
@@ -40,23 +310,133 @@ namespace ptk {
     void leave_isr();
 
     void wait_event(Thread &t, Event &e, ptk_time_t duration);
+    void wait_event_locked(Thread &t, Event &e, ptk_time_t duration);
     void signal_event(Event &e, eventmask_t mask);
     void broadcast_event(Event &e, eventmask_t mask);
 
+    /**
+     * @brief takes t off the wait list of the event, semaphore or mutex
+     * @returns false if t wasn't on one, because a signal already woke it
+     */
+    bool cancel_wait(Thread &t);
+
+    /**
+     * @brief waits on every event listed until the first one fires
+     *
+     * Use PTK_WAIT_EVENTS() rather than calling this directly.
+     */
+    void wait_events(Thread &t, const EventList &events, ptk_time_t duration);
+
+    /**
+     * @brief ends t's PTK_WAIT_EVENTS() wait without an event
+     * @returns false if t wasn't waiting, because an event already woke it
+     */
+    bool cancel_wait_events(Thread &t);
+
+    /**
+     * @brief takes a unit from a semaphore, or queues t to wait for one
+     * @returns true if t doesn't have to block, with wakeup_reason set to
+     *          WAKEUP_OK if it got a unit and WAKEUP_TIMEOUT if not
+     *
+     * Use PTK_SEM_WAIT() rather than calling this directly.
+     */
+    bool sem_wait(Thread &t, Semaphore &s, ptk_time_t duration);
+
+    /**
+     * @brief gives a unit to the first waiter, or to the count
+     *
+     * The kernel must be locked, as for signal_event(), so this also works
+     * from an interrupt handler.
+     */
+    void sem_signal(Semaphore &s);
+
+    /**
+     * @brief locks a mutex for t, or queues t to wait for it
+     * @returns true if t doesn't have to block, as for sem_wait()
+     *
+     * Use PTK_MUTEX_LOCK() rather than calling this directly. A blocked
+     * thread lends its priority to the owner.
+     *
+     * With PTK_MULTICORE, only owners whose home is the locking core get
+     * the boost. Moving a thread on another core's lists would need that
+     * core's lock.
+     */
+    bool mutex_lock(Thread &t, Mutex &m, ptk_time_t duration);
+
+    /**
+     * @brief unlocks a mutex held by t and hands it to the first waiter
+     */
+    void mutex_unlock(Thread &t, Mutex &m);
+
+    /**
+     * @brief checks an EventGroup for bits, or queues t to wait for them
+     * @returns true if t doesn't have to block, as for sem_wait()
+     *
+     * Use PTK_FLAGS_WAIT() rather than calling this directly.
+     */
+    bool flags_wait(Thread &t, EventGroup &g, uint32_t bits, uint8_t options,
+                    ptk_time_t duration);
+
+    /**
+     * @brief sets bits in an EventGroup and wakes the waiters they satisfy
+     *
+     * The kernel must be locked, as for signal_event().
+     */
+    void flags_set(EventGroup &g, uint32_t bits);
+
+    /**
+     * @brief clears bits in an EventGroup
+     *
+     * The kernel must be locked.
+     */
+    void flags_clear(EventGroup &g, uint32_t bits);
+
+    /**
+     * @brief broadcasts an event later, from the dispatch loop
+     *
+     * This is the lock-free alternative to lock_from_isr() followed by
+     * broadcast_event(). It leaves interrupts enabled, so a nested, higher
+     * priority handler can post while a lower one is in the middle of it.
+     * Posts to the same event before the kernel gets to it are merged into
+     * one broadcast, with their masks OR'ed together. Needs a core with
+     * atomic read-modify-write (LDREX/STREX on Cortex-M3 and up).
+     */
+    void post_event(Event &e, eventmask_t mask);
+
+    /**
+     * @brief runs d.call() before the next thread is dispatched
+     *
+     * Lock-free and safe from interrupt handlers, like post_event(). See
+     * DeferredCall.
+     */
+    void defer(DeferredCall &d);
+
     void lock();
     void unlock();
     void dump();
 
   };
 
-  extern Kernel *the_kernel;
+  extern PTK_CORE_LOCAL Kernel *the_kernel;
 
   inline void expire_timers(uint32_t time_delta) {
     the_kernel->expire_timers(time_delta);
   }
 
-  inline void arm_timer(Timer &t, ptk_time_t when) {
-    the_kernel->arm_timer(t, when);
+  inline void set_idle_hook(idle_hook_t hook) {
+    the_kernel->set_idle_hook(hook);
+  }
+
+  inline void arm_timer(Timer &t, ptk_time_t duration) {
+    the_kernel->arm_timer(t, duration);
+  }
+
+  inline void arm_timer_at(Timer &t, uint64_t when) {
+    the_kernel->arm_timer_at(t, when);
+  }
+
+  inline uint64_t now() {
+    return the_kernel->now();
   }
 
   inline void disarm_timer(Timer &t) {
@@ -67,6 +447,10 @@ namespace ptk {
     return the_kernel->timer_is_armed(t);
   }
 
+  inline ptk_time_t next_deadline() {
+    return the_kernel->next_deadline();
+  }
+
   inline void schedule_thread(Thread &t) {
     the_kernel->schedule(t);
   }
@@ -79,6 +463,35 @@ namespace ptk {
     the_kernel->wait_subthread(parent, sub, duration);
   }
 
+  // collects the subthreads of a PTK_WAIT_ALL() or PTK_WAIT_ANY(), and the
+  // timeout that follows them
+  inline void collect_subthreads(SubThread **, ptk_time_t &duration, ptk_time_t d) {
+    duration = d;
+  }
+
+  template<class... More>
+  inline void collect_subthreads(SubThread **subs, ptk_time_t &duration,
+                                 SubThread &sub, More&&... more) {
+    *subs = &sub;
+    collect_subthreads(subs + 1, duration, static_cast<More&&>(more)...);
+  }
+
+  template<class... Args>
+  inline void wait_all_subthreads(Thread &parent, Args&&... args) {
+    SubThread *subs[sizeof...(Args) - 1];
+    ptk_time_t duration;
+    collect_subthreads(subs, duration, static_cast<Args&&>(args)...);
+    the_kernel->wait_subthreads(parent, subs, sizeof...(Args) - 1, sizeof...(Args) - 1, duration);
+  }
+
+  template<class... Args>
+  inline void wait_any_subthread(Thread &parent, Args&&... args) {
+    SubThread *subs[sizeof...(Args) - 1];
+    ptk_time_t duration;
+    collect_subthreads(subs, duration, static_cast<Args&&>(args)...);
+    the_kernel->wait_subthreads(parent, subs, sizeof...(Args) - 1, 1, duration);
+  }
+
   inline void wakeup_thread(Thread &t, wakeup_t reason) {
     the_kernel->wakeup(t, reason);
   }
@@ -103,6 +516,14 @@ namespace ptk {
     the_kernel->wait_event(t, e, duration);
   }
 
+  inline void wait_events(Thread &t, const EventList &events, ptk_time_t duration) {
+    the_kernel->wait_events(t, events, duration);
+  }
+
+  inline void wait_event_locked(Thread &t, Event &e, ptk_time_t duration) {
+    the_kernel->wait_event_locked(t, e, duration);
+  }
+
   inline void signal_event(Event &e, eventmask_t mask) {
     the_kernel->signal_event(e, mask);
   }
@@ -111,6 +532,43 @@ namespace ptk {
     the_kernel->broadcast_event(e, mask);
   }
 
+  inline bool sem_wait(Thread &t, Semaphore &s, ptk_time_t duration) {
+    return the_kernel->sem_wait(t, s, duration);
+  }
+
+  inline void sem_signal(Semaphore &s) {
+    the_kernel->sem_signal(s);
+  }
+
+  inline bool mutex_lock(Thread &t, Mutex &m, ptk_time_t duration) {
+    return the_kernel->mutex_lock(t, m, duration);
+  }
+
+  inline void mutex_unlock(Thread &t, Mutex &m) {
+    the_kernel->mutex_unlock(t, m);
+  }
+
+  inline bool flags_wait(Thread &t, EventGroup &g, uint32_t bits, uint8_t options,
+                         ptk_time_t duration) {
+    return the_kernel->flags_wait(t, g, bits, options, duration);
+  }
+
+  inline void flags_set(EventGroup &g, uint32_t bits) {
+    the_kernel->flags_set(g, bits);
+  }
+
+  inline void flags_clear(EventGroup &g, uint32_t bits) {
+    the_kernel->flags_clear(g, bits);
+  }
+
+  inline void post_event(Event &e, eventmask_t mask) {
+    the_kernel->post_event(e, mask);
+  }
+
+  inline void defer_call(DeferredCall &d) {
+    the_kernel->defer(d);
+  }
+
   inline void lock_kernel() {
     the_kernel->lock();
   }
@@ -0,0 +1,195 @@
+#include "ptk/assert.h"
+#include "ptk/kernel.h"
+#include "ptk/port.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#if !defined(sigev_notify_thread_id)
+#define sigev_notify_thread_id _sigev_un._tid
+#endif
+
+using namespace ptk;
+
+enum {
+  MAX_SIGNALS = 65
+};
+
+PTK_CORE_LOCAL volatile sig_atomic_t port::interrupts_masked = 0;
+PTK_CORE_LOCAL volatile sig_atomic_t port::interrupts_pending = 0;
+PTK_CORE_LOCAL volatile sig_atomic_t port::isr_nesting = 0;
+
+static PTK_CORE_LOCAL volatile sig_atomic_t pending[MAX_SIGNALS];
+static port::isr_t isrs[MAX_SIGNALS];
+static sigset_t interrupt_signals;
+static bool interrupt_signals_valid = false;
+static pthread_t kernel_thread;
+
+static PTK_CORE_LOCAL bool tick_running = false;
+static PTK_CORE_LOCAL timer_t tick_timer;
+static PTK_CORE_LOCAL uint64_t tick_nsec;
+static PTK_CORE_LOCAL uint64_t last_tick;
+
+#if defined(PTK_MULTICORE)
+static pthread_t core_threads[PTK_MAX_CORES];
+
+// the interrupt only has to end sigsuspend() in idle()
+static void ipi_isr() {}
+#endif
+
+static uint64_t monotonic_nsec() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+static void run_isr(int signo) {
+  port::isr_nesting++;
+  isrs[signo]();
+  port::isr_nesting--;
+}
+
+static void signal_handler(int signo) {
+  int saved_errno = errno;
+
+  if (port::interrupts_masked) {
+    pending[signo] = 1;
+    port::interrupts_pending = 1;
+  } else {
+    run_isr(signo);
+  }
+
+  errno = saved_errno;
+}
+
+void port::dispatch_pending_interrupts() {
+  while (interrupts_pending) {
+    interrupts_pending = 0;
+
+    for (int signo=1; signo < MAX_SIGNALS; ++signo) {
+      if (pending[signo]) {
+        pending[signo] = 0;
+        run_isr(signo);
+      }
+    }
+  }
+}
+
+uint32_t port::timestamp() {
+  return (uint32_t) monotonic_nsec();
+}
+
+void port::attach_interrupt(int signo, isr_t isr) {
+  PTK_ASSERT(signo > 0 && signo < MAX_SIGNALS, "Bad signal number.");
+
+  if (!interrupt_signals_valid) {
+    sigemptyset(&interrupt_signals);
+    interrupt_signals_valid = true;
+  }
+
+  isrs[signo] = isr;
+  sigaddset(&interrupt_signals, signo);
+
+  struct sigaction action;
+  action.sa_handler = &signal_handler;
+  action.sa_flags = SA_RESTART;
+  sigfillset(&action.sa_mask);
+  sigaction(signo, &action, 0);
+}
+
+void port::raise_interrupt(int signo) {
+  pthread_kill(kernel_thread, signo);
+}
+
+void port::run_as_interrupt(isr_t isr) {
+  port::isr_nesting++;
+  isr();
+  port::isr_nesting--;
+}
+
+static void set_tick_timer(uint64_t first_nsec) {
+  struct itimerspec spec;
+  spec.it_value.tv_sec = first_nsec / 1000000000u;
+  spec.it_value.tv_nsec = first_nsec % 1000000000u;
+  spec.it_interval.tv_sec = tick_nsec / 1000000000u;
+  spec.it_interval.tv_nsec = tick_nsec % 1000000000u;
+  timer_settime(tick_timer, 0, &spec, 0);
+}
+
+static void tick_isr() {
+  // count whole tick periods, so that a late signal doesn't lose time
+  uint64_t now = monotonic_nsec() / tick_nsec;
+  uint32_t elapsed = (uint32_t) (now - last_tick);
+  last_tick = now;
+
+  if (elapsed > 0) {
+    enter_isr();
+    expire_timers(elapsed);
+    leave_isr();
+  }
+}
+
+void port::start(unsigned tick_usec) {
+#if defined(PTK_MULTICORE)
+  PTK_ASSERT(the_kernel != 0 && the_kernel->core() >= 0,
+             "Attach the kernel to a core before starting the port.");
+  core_threads[the_kernel->core()] = pthread_self();
+  if (the_kernel->core() == 0) kernel_thread = pthread_self();
+  attach_interrupt(PTK_PORT_IPI_SIGNAL, &ipi_isr);
+#else
+  kernel_thread = pthread_self();
+#endif
+  tick_nsec = (uint64_t) tick_usec * 1000u;
+  last_tick = monotonic_nsec() / tick_nsec;
+
+  attach_interrupt(SIGALRM, &tick_isr);
+
+  // deliver the tick to this thread, not to whichever one the kernel picks
+  struct sigevent event = {};
+  event.sigev_notify = SIGEV_THREAD_ID;
+  event.sigev_signo = SIGALRM;
+  event.sigev_notify_thread_id = (pid_t) syscall(SYS_gettid);
+  timer_create(CLOCK_MONOTONIC, &event, &tick_timer);
+
+  tick_running = true;
+  set_tick_timer(tick_nsec);
+}
+
+void port::stop() {
+  if (tick_running) {
+    timer_delete(tick_timer);
+    tick_running = false;
+  }
+}
+
+#if defined(PTK_MULTICORE)
+void port::wake_core(int core) {
+  pthread_kill(core_threads[core], PTK_PORT_IPI_SIGNAL);
+}
+#endif
+
+void port::idle(ptk_time_t duration) {
+  // Called with interrupts disabled. Sleep through the periodic tick until
+  // the deadline, unless something else interrupts first.
+  if (tick_running) {
+    if (duration == TIME_INFINITE) {
+      struct itimerspec off = {};
+      timer_settime(tick_timer, 0, &off, 0);
+    } else {
+      set_tick_timer(tick_nsec * (duration ? duration : 1));
+    }
+  }
+
+  // Block the real signals while checking for pending ones. sigsuspend()
+  // then waits and unblocks atomically, so a signal can't be missed.
+  sigset_t saved;
+  pthread_sigmask(SIG_BLOCK, &interrupt_signals, &saved);
+  if (!interrupts_pending) sigsuspend(&saved);
+  pthread_sigmask(SIG_SETMASK, &saved, 0);
+
+  // back to the periodic tick while threads are running
+  if (tick_running) set_tick_timer(tick_nsec);
+}
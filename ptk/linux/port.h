@@ -0,0 +1,102 @@
+#pragma once
+
+#include "ptk/timer.h"
+#include <signal.h>
+#include <stdint.h>
+
+/*
+ * Linux host port
+ *
+ * Interrupts are emulated with POSIX signals delivered to the thread that
+ * runs the Kernel. Each emulated interrupt is bound to a signal number with
+ * attach_interrupt(). Critical sections don't make system calls. They set a
+ * flag, and a signal that arrives while the flag is set is recorded as
+ * pending. The handler then runs from enable_interrupts(), the way an
+ * interrupt controller holds an IRQ until PRIMASK is cleared.
+ *
+ * start() attaches the kernel tick to SIGALRM, driven by a POSIX timer on
+ * CLOCK_MONOTONIC. The tick handler passes the number of whole tick periods
+ * since its previous run to expire_timers(), so late or coalesced signals
+ * never lose time. idle() reprograms that timer for the next deadline, so a
+ * sleeping host process takes no periodic wakeups.
+ *
+ * With PTK_MULTICORE, every worker that runs a Kernel calls start() and gets
+ * its own interrupt mask, tick and idle timer. Other cores wake a sleeping
+ * core with PTK_PORT_IPI_SIGNAL. Interrupts raised with raise_interrupt()
+ * go to core 0.
+ */
+#if !defined(PTK_PORT_IPI_SIGNAL)
+#define PTK_PORT_IPI_SIGNAL SIGUSR1
+#endif
+
+namespace ptk {
+  namespace port {
+    typedef void (*isr_t)();
+
+    extern PTK_CORE_LOCAL volatile sig_atomic_t interrupts_masked;
+    extern PTK_CORE_LOCAL volatile sig_atomic_t interrupts_pending;
+    extern PTK_CORE_LOCAL volatile sig_atomic_t isr_nesting;
+
+    void dispatch_pending_interrupts();
+
+    inline void disable_interrupts() {
+      interrupts_masked = 1;
+      __atomic_signal_fence(__ATOMIC_SEQ_CST);
+    }
+
+    inline void enable_interrupts() {
+      __atomic_signal_fence(__ATOMIC_SEQ_CST);
+      interrupts_masked = 0;
+      __atomic_signal_fence(__ATOMIC_SEQ_CST);
+      if (interrupts_pending) dispatch_pending_interrupts();
+    }
+
+    inline bool in_isr() {
+      return isr_nesting > 0;
+    }
+
+    // nanoseconds from CLOCK_MONOTONIC, truncated to 32 bits
+    uint32_t timestamp();
+
+    inline uint32_t timestamp_hz() {
+      return 1000000000;
+    }
+
+    void idle(ptk_time_t duration);
+
+    /**
+     * @brief starts the kernel tick on the calling thread
+     * @param[in] tick_usec length of one ptk_time_t tick in microseconds
+     *
+     * The calling thread becomes the one that receives emulated interrupts,
+     * so it should be the thread that calls Kernel::run_once().
+     */
+    void start(unsigned tick_usec = 1000);
+    void stop();
+
+#if defined(PTK_MULTICORE)
+    /**
+     * @brief interrupts a core, so that it returns from idle()
+     */
+    void wake_core(int core);
+#endif
+
+    /**
+     * @brief binds an emulated interrupt handler to a signal number
+     */
+    void attach_interrupt(int signo, isr_t isr);
+
+    /**
+     * @brief raises an emulated interrupt from any thread
+     */
+    void raise_interrupt(int signo);
+
+    /**
+     * @brief runs isr synchronously as if it were an interrupt handler
+     *
+     * Unit tests use this to exercise the ISR-only parts of the Kernel API,
+     * such as expire_timers(), without going through a signal.
+     */
+    void run_as_interrupt(isr_t isr);
+  }
+}
@@ -0,0 +1,171 @@
+#pragma once
+
+#include "ptk/assert.h"
+#include "ptk/thread.h"
+#include <new>
+#include <type_traits>
+#include <stddef.h>
+#include <stdint.h>
+
+namespace ptk {
+  /**
+   * @class Pool
+   * @brief Fixed-block allocator for up to N objects of type T
+   *
+   * All the storage is part of the Pool itself, sized at compile time, so
+   * nothing ever comes from the heap. Free blocks are kept on a lock-free
+   * stack, so create() and destroy() are O(1) and safe from interrupt
+   * handlers and other cores. The stack's links live beside the blocks
+   * rather than in them, at two bytes per block, so a taker that loses a
+   * race never reads a block that someone else is already using.
+   * The top of the stack is a block index with a tag that changes on every
+   * update, so a handler that takes and returns blocks in the middle of a
+   * pop can't fool it (the ABA problem). Like post_event(), this needs a
+   * core with atomic read-modify-write (LDREX/STREX on Cortex-M3 and up).
+   *
+   * @code
+   * static Pool<Message, 8> messages;
+   *
+   * Message *m = messages.create(id, payload);
+   * if (m == 0) ... // all 8 are in use
+   * ...
+   * messages.destroy(m);
+   * @endcode
+   */
+  template<class T, unsigned N>
+  class Pool {
+    static_assert(N > 0 && N < 0xffff, "Pool size must be between 1 and 65534");
+
+    enum {
+      INDEX_MASK = 0xffff,
+      TAG_ONE    = 0x10000
+    };
+
+    typedef typename std::aligned_storage<sizeof(T), alignof(T)>::type Block;
+
+    Block blocks[N];
+
+    // one more than the index of the next free block, 0 at the bottom
+    uint16_t next[N];
+
+    // tag in the upper half, one more than the top block's index below
+    volatile uint32_t top;
+    volatile uint16_t in_use;
+    volatile uint16_t most_in_use;
+
+  public:
+    Pool() : top(1), in_use(0), most_in_use(0) {
+      for (unsigned i=0; i < N; ++i) next[i] = (i + 1 < N) ? i + 2 : 0;
+    }
+
+    /**
+     * @brief takes a block, without constructing anything in it
+     * @returns 0 when every block is in use
+     */
+    void *allocate() {
+      uint32_t old_top = __atomic_load_n(&top, __ATOMIC_ACQUIRE);
+      uint32_t new_top;
+      unsigned index;
+      do {
+        index = old_top & INDEX_MASK;
+        if (index == 0) return 0;
+
+        // if another taker got here first, the tag has moved and this retries
+        new_top = ((old_top + TAG_ONE) & ~INDEX_MASK) |
+                  __atomic_load_n(&next[index - 1], __ATOMIC_RELAXED);
+      } while (!__atomic_compare_exchange_n(&top, &old_top, new_top, true,
+                                            __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+
+      uint16_t used = __atomic_add_fetch(&in_use, 1, __ATOMIC_RELAXED);
+      uint16_t most = __atomic_load_n(&most_in_use, __ATOMIC_RELAXED);
+      while (used > most &&
+             !__atomic_compare_exchange_n(&most_in_use, &most, used, true,
+                                          __ATOMIC_RELAXED, __ATOMIC_RELAXED)) ;
+      return &blocks[index - 1];
+    }
+
+    /**
+     * @brief gives back a block from allocate()
+     */
+    void release(void *p) {
+      Block *b = static_cast<Block *>(p);
+      PTK_ASSERT(b >= &blocks[0] && b < &blocks[N], "Block released to the wrong Pool.");
+
+      uint32_t index = (b - blocks) + 1;
+      uint32_t old_top = __atomic_load_n(&top, __ATOMIC_RELAXED);
+      uint32_t new_top;
+      do {
+        __atomic_store_n(&next[index - 1], (uint16_t) (old_top & INDEX_MASK), __ATOMIC_RELAXED);
+        new_top = ((old_top + TAG_ONE) & ~INDEX_MASK) | index;
+      } while (!__atomic_compare_exchange_n(&top, &old_top, new_top, true,
+                                            __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+
+      __atomic_sub_fetch(&in_use, 1, __ATOMIC_RELAXED);
+    }
+
+    /**
+     * @brief constructs a T in a free block
+     * @returns 0 when every block is in use
+     */
+    template<class... Args>
+    T *create(Args&&... args) {
+      void *p = allocate();
+      return p ? new (p) T(static_cast<Args&&>(args)...) : 0;
+    }
+
+    /**
+     * @brief destroys a T from create() and frees its block
+     */
+    void destroy(T *t) {
+      t->~T();
+      release(t);
+    }
+
+    unsigned used() const { return in_use; }
+    unsigned available() const { return N - in_use; }
+    static unsigned capacity() { return N; }
+
+    // the most blocks that were ever in use at once
+    unsigned high_water() const { return most_in_use; }
+    void reset_high_water() { most_in_use = in_use; }
+  };
+
+  /**
+   * @class ThreadPool
+   * @brief Pool of threads that go back to the pool when they finish
+   *
+   * spawn() constructs a thread, and the kernel destroys it once a dispatch
+   * leaves it in FINAL_STATE. Start a spawned Thread with schedule_thread(),
+   * or hand a spawned SubThread to PTK_WAIT_SUBTHREAD(). Either way, nobody
+   * may touch the thread after it has finished.
+   *
+   * @code
+   * static ThreadPool<CommandHandler, 4> handlers;
+   *
+   * CommandHandler *h = handlers.spawn(packet);
+   * if (h) PTK_WAIT_SUBTHREAD(*h, TIME_INFINITE);
+   * @endcode
+   */
+  template<class T, unsigned N>
+  class ThreadPool : public Reaper {
+    Pool<T, N> pool;
+
+  public:
+    /**
+     * @brief constructs a thread that will be reaped when it finishes
+     * @returns 0 when all N threads are in use
+     */
+    template<class... Args>
+    T *spawn(Args&&... args) {
+      T *t = pool.create(static_cast<Args&&>(args)...);
+      if (t) t->reaper = this;
+      return t;
+    }
+
+    virtual void reap(Thread &t) {
+      pool.destroy(static_cast<T *>(&t));
+    }
+
+    unsigned available() const { return pool.available(); }
+  };
+}
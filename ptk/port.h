@@ -0,0 +1,27 @@
+#pragma once
+
+/*
+ * Port layer
+ *
+ * Everything the Kernel needs from the CPU and the operating environment
+ * goes through the functions below, in namespace ptk::port:
+ *
+ *   void disable_interrupts()    enter a kernel critical section
+ *   void enable_interrupts()     leave it again
+ *   bool in_isr()                true while an interrupt handler is active
+ *   uint32_t timestamp()         free-running counter for measurements
+ *   uint32_t timestamp_hz()      rate at which timestamp() counts
+ *   void idle(ptk_time_t)        an idle_hook_t that sleeps until an
+ *                                interrupt is pending
+ *
+ * The port is chosen with PTK_PORT_CORTEXM or PTK_PORT_LINUX in conf_ptk.h.
+ * When neither is defined, Linux hosts get PTK_PORT_LINUX and everything
+ * else gets PTK_PORT_CORTEXM.
+ */
+#include "ptk/config.h"
+
+#if defined(PTK_PORT_LINUX)
+#include "ptk/linux/port.h"
+#else
+#include "ptk/cortexm/port.h"
+#endif
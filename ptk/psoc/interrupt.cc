@@ -144,10 +144,7 @@ void InterruptEvent::isr() {
   enter_isr();
 
   isr_hook();
-
-  lock_from_isr();
-  broadcast_event(*this, mask);
-  unlock_from_isr();
+  post_event(*this, mask);
   leave_isr();
 }
 
@@ -1,3 +1,5 @@
+#include "ptk/config.h"
+
 #include "ptk/kernel.cc"
 #include "ptk/thread.cc"
 #include "ptk/timer.cc"
@@ -5,3 +7,7 @@
 #include "ptk/shell.cc"
 #include "ptk/assert.cc"
 #include "ptk/stubs.cc"
+
+#if defined(PTK_PORT_LINUX)
+#include "ptk/linux/port.cc"
+#endif
@@ -5,4 +5,5 @@
 #include "ptk/timer.h"
 #include "ptk/kernel.h"
 #include "ptk/thread.h"
+#include "ptk/semaphore.h"
 
@@ -192,6 +192,7 @@ void SSD1306_128x32::run() {
 
   // reset device
   reset();
+  PTK_MUTEX_LOCK(io.lock, TIME_INFINITE);
   PTK_WAIT_SUBTHREAD(io.interpret(reset_sequence), TIME_INFINITE);
 
   // clear the screen
@@ -199,6 +200,7 @@ void SSD1306_128x32::run() {
   PTK_WAIT_SUBTHREAD(io.send_data((const uint8_t *) framebuffer.pages,
                                   sizeof(framebuffer.pages)), TIME_INFINITE);
   PTK_WAIT_SUBTHREAD(io.interpret(framebuffer_epilogue), TIME_INFINITE);
+  PTK_MUTEX_UNLOCK(io.lock);
 
   for (;;) {
     PTK_SLEEP(100);
@@ -210,10 +212,12 @@ void SSD1306_128x32::run() {
       dirty_rect = Rect(0, 0, 0, 0);
 
       // copy bits in framebuffer to device
+      PTK_MUTEX_LOCK(io.lock, TIME_INFINITE);
       PTK_WAIT_SUBTHREAD(io.interpret(framebuffer_prologue), TIME_INFINITE);
       PTK_WAIT_SUBTHREAD(io.send_data((const uint8_t *) framebuffer.pages,
                                       sizeof(framebuffer.pages)), TIME_INFINITE);
       PTK_WAIT_SUBTHREAD(io.interpret(framebuffer_epilogue), TIME_INFINITE);
+      PTK_MUTEX_UNLOCK(io.lock);
     }
   }
 
@@ -2,6 +2,7 @@
 
 #include "ptk/thread.h"
 #include "ptk/event.h"
+#include "ptk/semaphore.h"
 #include "ptk/screen/types.h"
 #include "ptk/screen/canvas.h"
 #include "ptk/screen/view.h"
@@ -31,7 +32,8 @@ namespace ptk {
       SubThread &interpret(const uint8_t *cmds);
       virtual SubThread &send_data(const uint8_t *data, unsigned len) = 0;
 
-    public:
+      // held around each command sequence, so several screens can share a bus
+      Mutex lock;
 
       enum cmd_t {
         SLEEP = 0x00,
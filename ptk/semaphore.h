@@ -0,0 +1,49 @@
+#pragma once
+
+#include "ptk/event.h"
+
+namespace ptk {
+  class Thread;
+
+  /**
+   * @class Semaphore
+   * @brief Counting semaphore that threads block on with PTK_SEM_WAIT()
+   *
+   * Waiters queue in priority order on the same kind of list as an Event.
+   * Kernel::sem_signal() hands a unit straight to the first waiter, or adds
+   * it to the count if nobody is waiting.
+   */
+  class Semaphore {
+    friend class ptk::Kernel;
+
+    Event waiters;
+    int32_t count;
+
+  public:
+    Semaphore(int32_t initial = 0) : count(initial) {}
+
+    int32_t value() const { return count; }
+  };
+
+  /**
+   * @class Mutex
+   * @brief Lock with an owner, taken with PTK_MUTEX_LOCK()
+   *
+   * While threads wait for it, the owner runs at the highest priority among
+   * them, so a middle priority thread can't keep a low priority owner from
+   * releasing it. This passes along chains of owners that wait on other
+   * mutexes. Mutexes are not recursive.
+   */
+  class Mutex {
+    friend class ptk::Kernel;
+
+    Event waiters;
+    Thread *owner;
+    Mutex *next_held;
+
+  public:
+    Mutex() : owner(0), next_held(0) {}
+
+    Thread *holder() const { return owner; }
+  };
+}
@@ -50,6 +50,7 @@ template bool ShellCommand::parse_number(const char *str, uint16_t &out);
 template bool ShellCommand::parse_number(const char *str, int16_t &out);
 template bool ShellCommand::parse_number(const char *str, uint8_t &out);
 template bool ShellCommand::parse_number(const char *str, int &out);
+template bool ShellCommand::parse_number(const char *str, uint32_t &out);
 
 bool ShellCommand::parse_bool(const char *str, bool &out) {
   static const Shell::keyword_t booleans[] = {
@@ -216,6 +217,24 @@ ShellCommand *ShellCommand::find_command(const char *name) {
 
 ////////////////////////////////////////////////////////////////////////////////
 
+// Commands that wait for room in the output between rows find each row's
+// thread or event again by its place in the registry, since a pooled thread
+// can be reaped, and an event destroyed, while they wait. One registered or
+// removed in the meantime only shifts the rows that follow.
+static Thread *nth_thread(unsigned n) {
+  Thread *t = all_registered_threads;
+  while (t && n--) t = t->next_registered_thread;
+  return t;
+}
+
+#if defined(PTK_WAKEUP_LATENCY)
+static Event *nth_event(unsigned n) {
+  Event *e = all_registered_events;
+  while (e && n--) e = e->next_registered_event;
+  return e;
+}
+#endif
+
 class HelpCommand : public ShellCommand {
   ShellCommand *cmd;
 
@@ -231,7 +250,8 @@ public:
     PTK_BEGIN();
     for (cmd = commands; cmd; cmd = cmd->next_command) {
       // wait a bit until there's (hopefully) room in the output buffer
-      PTK_WAIT_UNTIL(ShellCommand::out->available() > 16, 10);
+      PTK_WAIT_UNTIL_ON(ShellCommand::out->not_full,
+                        ShellCommand::out->available() > 16, 10);
       cmd->help(true);
     }
     PTK_END();
@@ -240,6 +260,7 @@ public:
 
 class ThreadsCommand : public ShellCommand {
   Thread *thread;
+  unsigned index;
 
 public:
   ThreadsCommand() : ShellCommand("threads") {
@@ -252,21 +273,289 @@ public:
 public:
   virtual void run() {
     PTK_BEGIN();
-    for (thread = all_registered_threads;
-         thread;
-         thread = thread->next_registered_thread)
-    {
+    for (index = 0; ; ++index) {
+      // wait a bit until there's (hopefully) room in the output buffer
+      PTK_WAIT_UNTIL_ON(ShellCommand::out->not_full,
+                        ShellCommand::out->available() > 64, 10);
+
+      thread = nth_thread(index);
+      if (thread == 0) break;
       if (thread->continuation) {
-        // wait a bit until there's (hopefully) room in the output buffer
-        PTK_WAIT_UNTIL(ShellCommand::out->available() > 64, 10);
-        printf("[%08x] %6s %s:%d\r\n",
-               thread,
+#if defined(PTK_RUN_BUDGET)
+        printf("[%08x] %6s %2d %5u %s:%d\r\n",
+               trace::object_id(thread),
                thread->state_name(),
+               thread->priority,
+               thread->stats.overruns,
                thread->debug_file,
                thread->debug_line);
+#else
+        printf("[%08x] %6s %2d %s:%d\r\n",
+               trace::object_id(thread),
+               thread->state_name(),
+               thread->priority,
+               thread->debug_file,
+               thread->debug_line);
+#endif
       }
     }
+
+#if defined(PTK_RUN_BUDGET)
+    // the thread may be gone by now, so only its address is shown
+    if (the_kernel->last_overrun().thread) {
+      const Overrun &o = the_kernel->last_overrun();
+      printf("%u overruns, last [%08x] by %u from %s:%d to %s:%d\r\n",
+             the_kernel->overruns(),
+             trace::object_id(o.thread),
+             o.cycles,
+             o.from_file,
+             o.from_line,
+             o.to_file,
+             o.to_line);
+    }
+#endif
     PTK_END();
   }
 
 } threads_command;
+
+#if defined(PTK_THREAD_STATS)
+class TopCommand : public ShellCommand {
+  Thread *thread;
+  unsigned index;
+  int window;
+  uint32_t window_begin, window_cycles;
+  uint64_t busy_cycles;
+
+public:
+  TopCommand() : ShellCommand("top") {
+  }
+
+  virtual void help(bool brief) {
+    if (brief) {
+      printf("%-10s - %s\r\n", name, "show cpu use of protothreads");
+    } else {
+      printf("usage: top [ticks]\r\n");
+      printf("  samples for ticks (default 1000), then shows each thread's\r\n");
+      printf("  share of the window. The other columns count since boot.\r\n");
+    }
+  }
+
+  virtual void run() {
+    PTK_BEGIN();
+    window = 1000;
+    if (argc > 1 && (!parse_number(argv[1], window) || window <= 0)) {
+      help(false);
+    } else {
+      for (thread = all_registered_threads; thread; thread = thread->next_registered_thread) {
+        thread->stats.window_start = thread->stats.total_time;
+      }
+      window_begin = the_kernel->cycles();
+      PTK_SLEEP(window);
+      window_cycles = the_kernel->cycles() - window_begin;
+      if (window_cycles == 0) window_cycles = 1;
+      busy_cycles = 0;
+
+      printf("thread        state pri   cpu     runs      max    ok   tmo   sub\r\n");
+      for (index = 0; ; ++index) {
+        // wait a bit until there's (hopefully) room in the output buffer
+        PTK_WAIT_UNTIL_ON(ShellCommand::out->not_full,
+                          ShellCommand::out->available() > 72, 10);
+
+        thread = nth_thread(index);
+        if (thread == 0) break;
+        if (thread->continuation == 0 &&
+            thread->stats.total_time == thread->stats.window_start) continue;
+        print_thread();
+      }
+
+      print_share("busy", busy_cycles);
+      printf(" of %u cycles\r\n", window_cycles);
+    }
+    PTK_END();
+  }
+
+private:
+  void print_share(const char *prefix, uint64_t used) {
+    unsigned permille = (unsigned) (used * 1000 / window_cycles);
+    printf("%s%3u.%u%%", prefix, permille / 10, permille % 10);
+  }
+
+  void print_thread() {
+    uint64_t used = thread->stats.total_time - thread->stats.window_start;
+    busy_cycles += used;
+
+    printf("[%08x] %6s %3d", trace::object_id(thread), thread->state_name(), thread->priority);
+    print_share(" ", used);
+    printf(" %8u %8u %5u %5u %5u\r\n",
+           thread->stats.runs,
+           thread->stats.max_time,
+           thread->stats.wakeups_ok,
+           thread->stats.wakeups_timeout,
+           thread->stats.wakeups_subthread);
+  }
+
+} top_command;
+#endif
+
+#if defined(PTK_WAKEUP_LATENCY)
+class LatencyCommand : public ShellCommand {
+  Thread *thread;
+  Event *event;
+  const LatencyHistogram *detail;
+  uint32_t id;
+  unsigned n, index;
+
+public:
+  LatencyCommand() : ShellCommand("latency") {
+  }
+
+  virtual void help(bool brief) {
+    if (brief) {
+      printf("%-10s - %s\r\n", name, "show wakeup latency histograms");
+    } else {
+      printf("usage: latency [reset|<address>]\r\n");
+      printf("  with no argument, shows the median, 99th percentile and worst\r\n");
+      printf("  bucket of every thread and event, in cycles. A bucket n+ counts\r\n");
+      printf("  anything from n up. With an address, shows all its buckets.\r\n");
+    }
+  }
+
+  virtual void run() {
+    PTK_BEGIN();
+    if (argc > 1 && !strcmp(argv[1], "reset")) {
+      for (thread = all_registered_threads; thread; thread = thread->next_registered_thread) {
+        thread->latency.reset();
+      }
+      for (event = all_registered_events; event; event = event->next_registered_event) {
+        event->latency.reset();
+      }
+    } else if (argc > 1) {
+      if (!parse_number(argv[1], id) || find(id) == 0) {
+        help(false);
+      } else {
+        for (n=0; n < LatencyHistogram::BUCKETS; ++n) {
+          PTK_WAIT_UNTIL_ON(ShellCommand::out->not_full,
+                            ShellCommand::out->available() > 32, 10);
+
+          // the object may have gone away while we waited
+          detail = find(id);
+          if (detail == 0) break;
+          if (detail->bucket(n) == 0) continue;
+          print_bound(n);
+          printf(" %10u\r\n", detail->bucket(n));
+        }
+      }
+    } else {
+      printf("object     kind       count       p50       p99     worst\r\n");
+      for (index = 0; ; ++index) {
+        PTK_WAIT_UNTIL_ON(ShellCommand::out->not_full,
+                          ShellCommand::out->available() > 64, 10);
+
+        thread = nth_thread(index);
+        if (thread == 0) break;
+        if (thread->latency.count() == 0) continue;
+        print_summary(thread, "thread", thread->latency);
+      }
+      for (index = 0; ; ++index) {
+        PTK_WAIT_UNTIL_ON(ShellCommand::out->not_full,
+                          ShellCommand::out->available() > 64, 10);
+
+        event = nth_event(index);
+        if (event == 0) break;
+        if (event->latency.count() == 0) continue;
+        print_summary(event, "event", event->latency);
+      }
+    }
+    PTK_END();
+  }
+
+private:
+  // ids are the ones shown here and in the trace, which on a 64-bit host
+  // are only the low half of the address
+  const LatencyHistogram *find(uint32_t id) {
+    for (Thread *t = all_registered_threads; t; t = t->next_registered_thread) {
+      if (trace::object_id(t) == id) return &t->latency;
+    }
+    for (Event *e = all_registered_events; e; e = e->next_registered_event) {
+      if (trace::object_id(e) == id) return &e->latency;
+    }
+    return 0;
+  }
+
+  // buckets are shown by their upper bound, except the last which is open
+  void print_bound(unsigned n) {
+    if (n == LatencyHistogram::BUCKETS - 1) {
+      printf(" %8u+", 1u << n);
+    } else {
+      printf(" %9u", (1u << (n + 1)) - 1);
+    }
+  }
+
+  void print_summary(const void *object, const char *kind, const LatencyHistogram &h) {
+    unsigned worst = LatencyHistogram::BUCKETS - 1;
+    while (worst > 0 && h.bucket(worst) == 0) worst--;
+
+    printf("[%08x] %-6s %9u", trace::object_id(object), kind, h.count());
+    print_bound(h.percentile(500));
+    print_bound(h.percentile(990));
+    print_bound(worst);
+    printf("\r\n");
+  }
+
+} latency_command;
+#endif
+
+#if defined(PTK_TRACE)
+class TraceCommand : public ShellCommand {
+  trace::Buffer *buffer;
+  unsigned index, count;
+  bool was_enabled;
+
+public:
+  TraceCommand() : ShellCommand("trace") {
+  }
+
+  virtual void help(bool brief) {
+    if (brief) {
+      printf("%-10s - %s\r\n", name, "dump or control the scheduler trace");
+    } else {
+      printf("usage: trace [on|off|clear]\r\n");
+      printf("  with no argument, dumps the trace for ptk_trace2json\r\n");
+    }
+  }
+
+  virtual void run() {
+    PTK_BEGIN();
+    buffer = &the_kernel->trace_buffer();
+
+    if (argc > 1) {
+      bool on;
+      if (!strcmp(argv[1], "clear")) {
+        buffer->clear();
+      } else if (parse_bool(argv[1], on)) {
+        buffer->enable(on);
+      } else {
+        help(false);
+      }
+    } else {
+      // stop recording, so that printing the dump doesn't overwrite it
+      was_enabled = buffer->is_enabled();
+      buffer->enable(false);
+
+      count = buffer->count();
+      printf("ptk-trace %d %u %u\r\n", trace::VERSION, port::timestamp_hz(), count);
+      for (index=0; index < count; ++index) {
+        PTK_WAIT_UNTIL_ON(ShellCommand::out->not_full,
+                          ShellCommand::out->available() > 40, 10);
+        const trace::Record &r = buffer->get(index);
+        printf("%02x %08x %08x %08x\r\n", r.kind, r.timestamp, r.object, r.arg);
+      }
+
+      buffer->enable(was_enabled);
+    }
+    PTK_END();
+  }
+
+} trace_command;
+#endif
@@ -6,6 +6,9 @@ using namespace ptk;
 
 Thread *ptk::all_registered_threads = 0;
 
+// threads can come and go on any core
+static CoreLock registry_lock;
+
 const char *Thread::state_name() const {
   switch (state) {
   case INIT_STATE : return "INIT";
@@ -16,35 +19,102 @@ const char *Thread::state_name() const {
   case WAIT_SUBTHREAD_STATE : return "W_THRD";
   case FINAL_STATE : return "FINAL";
   case RESET_STATE : return "RESET";
+  case WAIT_SEM_STATE : return "W_SEM";
+  case WAIT_MUTEX_STATE : return "W_MUTX";
+  case WAIT_FLAGS_STATE : return "W_FLAG";
+  case WAIT_EVENTS_STATE : return "W_EVTS";
   default : return "???";
   }
 }
 
-Thread::Thread() :
+Thread::Thread(priority_t priority) :
   Timer(),
+#if defined(PTK_EDF)
+  ready_seq(0),
+  relative_deadline(TIME_INFINITE),
+  deadline(0),
+#endif
+  waiting_for(0),
+#if defined(PTK_LAZY_BROADCAST)
+  wait_seq(0),
+#endif
+  blocked_on(0),
+  held_mutexes(0),
+  event_flags(0),
+  flags_options(0),
+  wait_nodes(0),
+  fired(0),
+  reaper(0),
+  join_state(0),
+#if defined(PTK_WAKEUP_LATENCY)
+  woken_at(0),
+  woken_by(0),
+  woken(false),
+#endif
+#if defined(PTK_RUN_BUDGET)
+  run_budget(0),
+#endif
+#if defined(PTK_MULTICORE)
+  home(0),
+  remote_next(0),
+#endif
+  wait_duration(TIME_INFINITE),
 #if defined(PTK_DEBUG)
   debug_file(0),
   debug_line(0),
 #endif
   continuation(0),
   state(INIT_STATE),
-  wakeup_reason(WAKEUP_OK)
+  wakeup_reason(WAKEUP_OK),
+  priority(priority),
+  base_priority(priority)
+#if defined(PTK_THREAD_STATS)
+  , stats()
+#endif
 {
+  PTK_ASSERT(priority < PTK_PRIORITY_LEVELS, "Thread priority out of range.");
+
+  registry_lock.acquire();
   next_registered_thread = all_registered_threads;
+  if (next_registered_thread) next_registered_thread->registered_prev = &next_registered_thread;
+  registered_prev = &all_registered_threads;
   all_registered_threads = this;
+  registry_lock.release();
 }
 
 Thread::~Thread() {
-  // need to remove this thread from the all_registered_threads list
-  ptk_halt("dangling thread");
+  // take the thread off the kernel's timers and lists, if it's on any
+  if (the_kernel) the_kernel->unregister_thread(*this);
+
+  registry_lock.acquire();
+  *registered_prev = next_registered_thread;
+  if (next_registered_thread) next_registered_thread->registered_prev = registered_prev;
+  registry_lock.release();
 }
 
 void Thread::timer_expired() {
   lock_from_isr();
-  wakeup_reason = WAKEUP_TIMEOUT;
   timer_expiration = TIME_NEVER;
-  state = READY_STATE;
-  schedule_thread(*this);
+
+  // A thread on a wait list has to leave it. If a signal already took it
+  // off, that signal has woken it, and this timeout came too late. The
+  // same goes for a multi-event wait that one of its events has ended,
+  // and for a join that the last subthread has just completed.
+  bool late;
+  if (state & WAIT_LIST_STATES) {
+    late = !the_kernel->cancel_wait(*this);
+  } else if (state == WAIT_EVENTS_STATE) {
+    late = !the_kernel->cancel_wait_events(*this);
+  } else if (state == WAIT_SUBTHREAD_STATE) {
+    late = !the_kernel->cancel_join(*this);
+  } else {
+    late = false;
+  }
+
+  if (!late) {
+    state = READY_STATE;
+    wakeup_thread(*this, WAKEUP_TIMEOUT);
+  }
   unlock_from_isr();
 }
 
@@ -53,12 +123,16 @@ void Thread::ptk_end() {
   continuation = 0;
 }
 
-SubThread::SubThread() :
+SubThread::SubThread(priority_t priority) :
+  Thread(priority),
+  join_seq(0),
   parent(0)
 {
 }
 
 void SubThread::reset() {
+  // a parent can restart a body that never finished
+  continuation = 0;
   parent = 0;
   state = INIT_STATE;
 }
@@ -67,8 +141,7 @@ void SubThread::ptk_end() {
   Thread::ptk_end();
   if (parent != 0) {
     lock_kernel();
-    wakeup_thread(*parent, WAKEUP_SUBTHREAD_DONE);
-    parent = 0;
+    the_kernel->subthread_done(*this);
     unlock_kernel();
   }
 }
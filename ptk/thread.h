@@ -2,14 +2,20 @@
 
 #include "ptk/dqueue.h"
 #include "ptk/timer.h"
+#include "ptk/histogram.h"
+#include "ptk/iheap.h"
 
 #define PTK_DEBUG 1
 
 namespace ptk {
   class Kernel;
+  class Event;
+  struct EventWaitNode;
   class Semaphore;
+  class Mutex;
 
   typedef int32_t wakeup_t;
+  typedef uint8_t priority_t;
 
   enum {
     WAKEUP_OK             = 1 << 0,
@@ -27,7 +33,11 @@ namespace ptk {
     PTK_THREAD_STATE(WAIT_EVENT,     32)        \
     PTK_THREAD_STATE(WAIT_SUBTHREAD, 64)        \
     PTK_THREAD_STATE(FINAL,          128)       \
-    PTK_THREAD_STATE(RESET,          256)
+    PTK_THREAD_STATE(RESET,          256)       \
+    PTK_THREAD_STATE(WAIT_SEM,       512)       \
+    PTK_THREAD_STATE(WAIT_MUTEX,     1024)      \
+    PTK_THREAD_STATE(WAIT_FLAGS,     2048)      \
+    PTK_THREAD_STATE(WAIT_EVENTS,    4096)
 
   enum thread_state {
 #define PTK_THREAD_STATE(name,val) name##_STATE = val,
@@ -36,15 +46,51 @@ namespace ptk {
   };
 
   enum {
-    RUNNABLE_STATES = (READY_STATE | YIELDED_STATE | WAIT_COND_STATE)
+    RUNNABLE_STATES = (READY_STATE | YIELDED_STATE | WAIT_COND_STATE),
+    WAIT_LIST_STATES = (WAIT_EVENT_STATE | WAIT_SEM_STATE | WAIT_MUTEX_STATE | WAIT_FLAGS_STATE)
   };
 
+#if defined(PTK_THREAD_STATS)
+  /*
+   * Kept up to date by the Kernel. Times are in cycle counter units. Events
+   * wake threads with their own masks, which count as WAKEUP_OK here.
+   */
+  struct ThreadStats {
+    uint32_t runs;
+    uint32_t max_time;
+    uint64_t total_time;
+    uint32_t wakeups_ok;
+    uint32_t wakeups_timeout;
+    uint32_t wakeups_subthread;
+#if defined(PTK_RUN_BUDGET)
+    uint32_t overruns;
+#endif
+
+    // total_time when the current sampling window began
+    uint64_t window_start;
+  };
+#endif
+
 #define PTK_LABEL_AT_LINE_HELPER(n) PTK_LINE_##n
 #define PTK_LABEL_AT_LINE(n) PTK_LABEL_AT_LINE_HELPER(n)
 #define PTK_HERE PTK_LABEL_AT_LINE(__LINE__)
 
+  class Thread;
+
+  /*
+   * Takes back threads once they finish, like a ThreadPool does. The kernel
+   * calls reap() after the dispatch that leaves a thread with a reaper in
+   * FINAL_STATE, once nothing refers to the thread anymore, and without
+   * the kernel lock.
+   */
+  class Reaper {
+  public:
+    virtual void reap(Thread &t) = 0;
+  };
+
   class Thread : protected Timer {
     friend class Kernel;
+    template<class T, unsigned N> friend class ThreadPool;
     friend class Semaphore;
     friend class Event;
     friend class ThreadsCommand;
@@ -52,32 +98,148 @@ namespace ptk {
     i2link_t registry_link;
     i2link_t ready_link;
 
+#if defined(PTK_EDF)
+    // position in the ready heap, and when the thread joined it
+    iheaplink_t ready_heap_link;
+    uint32_t ready_seq;
+
+    // in kernel ticks, TIME_INFINITE for none
+    ptk_time_t relative_deadline;
+    ptk_time_t deadline;
+#endif
+
+    // the wait list holding this thread, while it's on one
+    Event *waiting_for;
+#if defined(PTK_LAZY_BROADCAST)
+    uint8_t wait_seq;
+#endif
+
+    // the mutex this thread is waiting to lock, and the first one it holds
+    Mutex *blocked_on;
+    Mutex *held_mutexes;
+
+    // the EventGroup flags wanted while waiting, and the group's flags once
+    // the wait is over
+    uint32_t event_flags;
+    uint8_t flags_options;
+
+    // the nodes of a PTK_WAIT_EVENTS() until one of the events fires, and
+    // then that event
+    EventWaitNode *volatile wait_nodes;
+    Event *fired;
+
+    // whoever destroys the thread when it finishes, if anyone
+    Reaper *reaper;
+
+    // the pointer to this thread in the registry, for O(1) removal
+    Thread **registered_prev;
+
+    // the current join's number in the upper half, and the number of
+    // subthreads it still needs in the lower, 0 once it's over
+    volatile uint32_t join_state;
+
+#if defined(PTK_WAKEUP_LATENCY)
+    // when the last wakeup happened and which event it came through, if any
+    uint32_t woken_at;
+    Event *woken_by;
+    bool woken;
+#endif
+
+#if defined(PTK_RUN_BUDGET)
+    // 0 for the kernel's
+    uint32_t run_budget;
+#endif
+
+#if defined(PTK_MULTICORE)
+    // the core whose ready lists hold this thread, set on its first schedule
+    Kernel *home;
+    Thread *remote_next;
+#endif
+
   protected:
+    // the timeout of a PTK_WAIT_UNTIL_ON(), kept for each time it resumes
+    ptk_time_t wait_duration;
+
     virtual void run() = 0;
     virtual void timer_expired();
     virtual void ptk_end();
 
   public:
-    Thread();
+    Thread(priority_t priority = PTK_DEFAULT_PRIORITY);
     virtual ~Thread();
 
+#if defined(PTK_EDF)
+    /**
+     * @brief sets how soon after each wakeup the thread must be done
+     * @param[in] relative ticks from becoming ready, or TIME_INFINITE
+     *
+     * Takes effect from the next wakeup, so a periodic thread calls this
+     * once and then sleeps until each period starts.
+     */
+    void set_deadline(ptk_time_t relative) { relative_deadline = relative; }
+#endif
+
+#if defined(PTK_RUN_BUDGET)
+    /**
+     * @brief gives this thread a budget other than the kernel's
+     * @param[in] cycles the longest one run() may take, 0 for the kernel's
+     */
+    void set_run_budget(uint32_t cycles) { run_budget = cycles; }
+#endif
+
 #if defined(PTK_DEBUG)
     const char *debug_file;
     int debug_line;
 #endif
 
     const char *state_name() const;
+
+    /**
+     * @brief the EventGroup's flags when the last PTK_FLAGS_WAIT() ended
+     *
+     * Taken before any auto-clear, so they include the flags waited for.
+     * Not meaningful after a timeout that blocked.
+     */
+    uint32_t wait_flags() const { return event_flags; }
+
+    /**
+     * @brief the event that ended the last PTK_WAIT_EVENTS()
+     *
+     * 0 if the wait timed out.
+     */
+    Event *fired_event() const { return fired; }
+
     void *continuation;
     thread_state state;
     wakeup_t wakeup_reason;
+
+    // priority is raised above base_priority while holding a contended Mutex
+    priority_t priority;
+    const priority_t base_priority;
     Thread *next_registered_thread;
+
+#if defined(PTK_THREAD_STATS)
+    ThreadStats stats;
+#endif
+
+#if defined(PTK_WAKEUP_LATENCY)
+    LatencyHistogram latency;
+#endif
   };
 
+  /*
+   * Every thread that hasn't been destroyed yet, newest first. Code that
+   * walks the list across a yield has to be sure the thread it stopped at
+   * is still around when it resumes.
+   */
   extern Thread *all_registered_threads;
 
   class SubThread : public Thread {
     friend class Kernel;
 
+    // the parent's join this subthread was started for
+    uint16_t join_seq;
+
   protected:
     Thread *parent;
 
@@ -85,7 +247,7 @@ namespace ptk {
     virtual void ptk_end();
 
   public:
-    SubThread();
+    SubThread(priority_t priority = PTK_DEFAULT_PRIORITY);
   };
 
 #if defined(PTK_DEBUG)
@@ -124,11 +286,29 @@ namespace ptk {
   PTK_HERE: ;                                       \
   } while (0)                                        
                                                      
+/*
+ * Sleeps until an absolute tick from now(). A loop that adds its period to
+ * the previous deadline each time around keeps its phase, however long
+ * each pass takes. A deadline that has passed sleeps until the next tick.
+ */
+#define PTK_SLEEP_UNTIL(when)                       \
+  do {                                              \
+    lock_kernel();                                  \
+    state = SLEEPING_STATE;                         \
+    unschedule_thread(*this);                       \
+    arm_timer_at(*this, (when));                    \
+    continuation = &&PTK_HERE;                      \
+    unlock_kernel();                                \
+    PTK_DEBUG_SAVE();                               \
+    return;                                         \
+  PTK_HERE: ;                                       \
+  } while (0)
+
 #define PTK_WAIT_EVENT(event,duration)              \
   do {                                              \
+    state = WAIT_EVENT_STATE;                       \
     wait_event(*this, event, duration);             \
     continuation = &&PTK_HERE;                      \
-    state = WAIT_EVENT_STATE;                       \
     PTK_DEBUG_SAVE();                               \
     return;                                         \
   PTK_HERE: ;                                       \
@@ -139,9 +319,9 @@ namespace ptk {
 
 #define PTK_UNLOCK_WAIT_EVENT(event,duration)       \
   do {                                              \
-    wait_event(*this, event, duration);             \
-    continuation = &&PTK_HERE;                      \
     state = WAIT_EVENT_STATE;                       \
+    wait_event_locked(*this, event, duration);      \
+    continuation = &&PTK_HERE;                      \
     unlock_kernel();                                \
     PTK_DEBUG_SAVE();                               \
     return;                                         \
@@ -180,6 +360,77 @@ namespace ptk {
     unlock_kernel();                                \
   } while(0)
 
+/*
+ * Start every subthread listed, then wait until all of them or any one of
+ * them has finished. The timeout comes after the subthreads:
+ *
+ *   PTK_WAIT_ALL(display, usb, sensors, 100);
+ *
+ * wakeup_reason ends up WAKEUP_SUBTHREAD_DONE or WAKEUP_TIMEOUT. The
+ * subthreads left running after a timeout, or after PTK_WAIT_ANY() is
+ * satisfied, keep running, but no longer wake the thread when they finish.
+ * Forking one of them again stops it wherever it is, off any timer, wait
+ * or ready list, and starts its body over. It mustn't hold a mutex then.
+ */
+#define PTK_WAIT_ALL(...)                           \
+  do {                                              \
+    lock_kernel();                                  \
+    wait_all_subthreads(*this, __VA_ARGS__);        \
+    continuation = &&PTK_HERE;                      \
+    state = WAIT_SUBTHREAD_STATE;                   \
+    unlock_kernel();                                \
+    PTK_DEBUG_SAVE();                               \
+    return;                                         \
+  PTK_HERE: ;                                       \
+    lock_kernel();                                  \
+    disarm_timer(*this);                            \
+    unlock_kernel();                                \
+  } while(0)
+
+#define PTK_WAIT_ANY(...)                           \
+  do {                                              \
+    lock_kernel();                                  \
+    wait_any_subthread(*this, __VA_ARGS__);         \
+    continuation = &&PTK_HERE;                      \
+    state = WAIT_SUBTHREAD_STATE;                   \
+    unlock_kernel();                                \
+    PTK_DEBUG_SAVE();                               \
+    return;                                         \
+  PTK_HERE: ;                                       \
+    lock_kernel();                                  \
+    disarm_timer(*this);                            \
+    unlock_kernel();                                \
+  } while(0)
+
+/*
+ * Waits until any of several events is signaled, or the timeout passes.
+ * The events are a braced list of pointers:
+ *
+ *   PTK_WAIT_EVENTS({&rx_ready, &tx_space, &stop}, 100);
+ *   if (fired_event() == &stop) ...
+ *
+ * The first event to fire wakes the thread, with its mask in
+ * wakeup_reason as for PTK_WAIT_EVENT(), and takes the thread off the
+ * others. fired_event() says which it was, or is 0 after a timeout.
+ */
+#define PTK_WAIT_EVENTS(...)                        \
+  do {                                              \
+    state = WAIT_EVENTS_STATE;                      \
+    wait_events(*this, __VA_ARGS__);                \
+    continuation = &&PTK_HERE;                      \
+    PTK_DEBUG_SAVE();                               \
+    return;                                         \
+  PTK_HERE: ;                                       \
+    lock_kernel();                                  \
+    disarm_timer(*this);                            \
+    unlock_kernel();                                \
+  } while(0)
+
+/*
+ * PTK_WAIT_UNTIL() keeps the thread runnable, so the condition is tested
+ * on every pass of the scheduler. Prefer PTK_WAIT_UNTIL_ON() when some
+ * Event is signaled whenever the condition may have changed.
+ */
 #define PTK_WAIT_UNTIL(condition,duration)          \
   do {                                              \
     lock_kernel();                                  \
@@ -201,6 +452,91 @@ namespace ptk {
     }                                               \
   } while (0)
 
+/*
+ * Semaphores and mutexes. When the wait is over, wakeup_reason is
+ * WAKEUP_OK if the thread got the unit or the lock, and WAKEUP_TIMEOUT if
+ * it didn't. Neither blocks when the semaphore or the mutex is available.
+ */
+#define PTK_SEM_WAIT(sem,duration)                  \
+  do {                                              \
+    if (sem_wait(*this, sem, duration)) break;      \
+    continuation = &&PTK_HERE;                      \
+    PTK_DEBUG_SAVE();                               \
+    return;                                         \
+  PTK_HERE: ;                                       \
+    lock_kernel();                                  \
+    disarm_timer(*this);                            \
+    unlock_kernel();                                \
+  } while (0)
+
+#define PTK_MUTEX_LOCK(mutex,duration)              \
+  do {                                              \
+    if (mutex_lock(*this, mutex, duration)) break;  \
+    continuation = &&PTK_HERE;                      \
+    PTK_DEBUG_SAVE();                               \
+    return;                                         \
+  PTK_HERE: ;                                       \
+    lock_kernel();                                  \
+    disarm_timer(*this);                            \
+    unlock_kernel();                                \
+  } while (0)
+
+#define PTK_MUTEX_UNLOCK(mutex)                     \
+  mutex_unlock(*this, mutex)
+
+/*
+ * Waits until any or all of the given bits are set in an EventGroup,
+ * depending on whether options includes FLAGS_ALL. With FLAGS_CLEAR, the
+ * bits the wait was waiting for are cleared when it's satisfied. It
+ * doesn't block when the flags are already set. wakeup_reason ends up
+ * WAKEUP_OK or WAKEUP_TIMEOUT, and wait_flags() has the group's flags.
+ */
+#define PTK_FLAGS_WAIT(group,bits,options,duration) \
+  do {                                              \
+    if (flags_wait(*this, group, bits, options, duration)) break; \
+    continuation = &&PTK_HERE;                      \
+    PTK_DEBUG_SAVE();                               \
+    return;                                         \
+  PTK_HERE: ;                                       \
+    lock_kernel();                                  \
+    disarm_timer(*this);                            \
+    unlock_kernel();                                \
+  } while (0)
+
+/*
+ * Waits on event until condition holds, testing it only when the event is
+ * signaled. The timeout covers the whole wait, not each signal. The
+ * condition is tested with the kernel locked, so a signal can't slip in
+ * between the test and the wait, and it must not lock the kernel itself.
+ * The duration is evaluated once, when the wait starts. wakeup_reason ends
+ * up WAKEUP_OK or WAKEUP_TIMEOUT.
+ */
+#define PTK_WAIT_UNTIL_ON(event,condition,duration) \
+  do {                                              \
+    lock_kernel();                                  \
+    wait_duration = (duration);                     \
+    arm_timer(*this, wait_duration);                \
+    unlock_kernel();                                \
+  PTK_HERE: ;                                       \
+    lock_kernel();                                  \
+    if (condition) {                                \
+      disarm_timer(*this);                          \
+      wakeup_reason = WAKEUP_OK;                    \
+    } else if (wait_duration != TIME_INFINITE &&    \
+               timer_expiration == TIME_NEVER) {    \
+      wakeup_reason = WAKEUP_TIMEOUT;               \
+    } else {                                        \
+      state = WAIT_EVENT_STATE;                     \
+      wait_event_locked(*this, event, TIME_INFINITE); \
+      continuation = &&PTK_HERE;                    \
+      unlock_kernel();                              \
+      PTK_DEBUG_SAVE();                             \
+      return;                                       \
+    }                                               \
+    state = READY_STATE;                            \
+    unlock_kernel();                                \
+  } while (0)
+
 #define PTK_END()                                   \
   do {                                              \
   thread_exit:                                      \
@@ -3,9 +3,132 @@
 using namespace ptk;
 
 Timer::Timer() :
-  timer_expiration(TIME_NEVER)
+  timer_expiration(TIME_NEVER),
+  timer_deadline(0)
+#if defined(PTK_TIMER_WHEEL)
+  , timer_slot(TimerWheel::NO_SLOT)
+#endif
 {}
 
 void Timer::reset() {
   timer_expiration = TIME_NEVER;
 }
+
+#if defined(PTK_TIMER_WHEEL)
+
+// bitmask with one bit per slot in a level
+static const uint32_t ALL_SLOTS =
+  (uint32_t) (((uint64_t) 1 << TimerWheel::SLOTS) - 1);
+
+static uint32_t rotate_slots(uint32_t bits, unsigned n) {
+  if (n == 0) return bits;
+  return ((bits << n) | (bits >> (TimerWheel::SLOTS - n))) & ALL_SLOTS;
+}
+
+TimerWheel::TimerWheel() :
+  clock(0)
+{
+  for (unsigned level=0; level < LEVELS; ++level) occupied[level] = 0;
+}
+
+void TimerWheel::insert(Timer &t, ptk_time_t duration) {
+  insert_at(t, clock + duration);
+}
+
+void TimerWheel::insert_at(Timer &t, uint64_t when) {
+  t.timer_deadline = when;
+
+  // A timer filed in the slot for the current tick would not be visited
+  // until the wheel comes all the way around, so one that is already due
+  // waits for the next tick. Its lateness still counts from when.
+  place(t, when > clock ? when : clock + 1);
+}
+
+void TimerWheel::place(Timer &t, uint64_t when) {
+  // when > clock, and the distance always fits in 32 bits
+  uint32_t remaining = (uint32_t) (when - clock);
+  unsigned level = (31 - __builtin_clz(remaining)) / BITS;
+  unsigned slot = (unsigned) (when >> (level * BITS)) & MASK;
+
+  t.timer_slot = level * SLOTS + slot;
+  slots[t.timer_slot].push_back(t);
+  occupied[level] |= 1u << slot;
+}
+
+void TimerWheel::remove(Timer &t) {
+  if (t.timer_slot == NO_SLOT) return;
+
+  List &s = slots[t.timer_slot];
+  s.remove(t);
+  if (s.empty()) occupied[t.timer_slot / SLOTS] &= ~(1u << (t.timer_slot & MASK));
+  t.timer_slot = NO_SLOT;
+}
+
+ptk_time_t TimerWheel::next_expiration() const {
+  uint64_t nearest = TIME_INFINITE;
+
+  for (unsigned level=0; level < LEVELS; ++level) {
+    if (occupied[level] == 0) continue;
+
+    const unsigned shift = level * BITS;
+    const uint64_t base = clock >> shift;
+
+    // rotate the occupied slots so that bit 0 is the next one to be visited
+    unsigned first = (unsigned) (base + 1) & MASK;
+    uint32_t pending = rotate_slots(occupied[level], (SLOTS - first) & MASK);
+    uint64_t visit = ((base + 1 + __builtin_ctz(pending)) << shift) - clock;
+
+    if (visit < nearest) nearest = visit;
+  }
+
+  return (ptk_time_t) nearest;
+}
+
+void TimerWheel::advance(ptk_time_t delta, I2List<Timer> &expired) {
+  List todo;
+  const uint64_t from = clock;
+  const uint64_t to = clock + delta;
+
+  // phase 1: empty every slot the clock passes over on its way to the new time
+  for (unsigned level=0; level < LEVELS; ++level) {
+    const unsigned shift = level * BITS;
+    const uint64_t ticks = (to >> shift) - (from >> shift);
+
+    // if this level didn't move, none of the coarser ones did either
+    if (ticks == 0) break;
+
+    uint32_t visited = ALL_SLOTS;
+    if (ticks < SLOTS) {
+      unsigned first = (unsigned) ((from >> shift) + 1) & MASK;
+      visited = rotate_slots((1u << ticks) - 1, first);
+    }
+
+    uint32_t hit = occupied[level] & visited;
+    occupied[level] &= ~hit;
+
+    while (hit) {
+      unsigned slot = __builtin_ctz(hit);
+      hit &= hit - 1;
+
+      Timer *t;
+      List &s = slots[level * SLOTS + slot];
+      while ((t = s.pop())) todo.push(*t);
+    }
+  }
+
+  clock = to;
+
+  // phase 2: expire what's due and file everything else on a finer level
+  Timer *t;
+  while ((t = todo.pop())) {
+    if (t->timer_deadline <= clock) {
+      t->timer_slot = NO_SLOT;
+      t->timer_expiration = (ptk_time_t) (clock - t->timer_deadline);
+      expired.push(*t);
+    } else {
+      place(*t, t->timer_deadline);
+    }
+  }
+}
+
+#endif // defined(PTK_TIMER_WHEEL)
@@ -1,18 +1,26 @@
 #pragma once
 
+#include "ptk/config.h"
 #include "ptk/assert.h"
 #include "ptk/ilist.h"
 #include <stdint.h>
 
 namespace ptk {
   class Kernel;
+  class TimerWheel;
 
   typedef uint32_t ptk_time_t;
 
   /*
-   * The order of the constants below is such that a ptk_time_t value
-   * can be decremented to account for the passage of time if it's
-   * value is less than TIME_INFINITE.
+   * A ptk_time_t is a duration in ticks, where the two largest values mean
+   * "wait forever" and "not armed". Points in time are 64-bit tick counts
+   * from Kernel::now(), which starts at 0 and never wraps in practice.
+   *
+   * While a Timer is armed, timer_deadline holds the tick it expires on and
+   * timer_expiration the duration it was armed with. Neither changes as
+   * time passes. timer_expired() sees in timer_expiration the time that has
+   * elapsed since the deadline. To arm itself again, timer_expired() sets
+   * timer_expiration to TIME_NEVER first.
    */
   enum {
     TIME_IMMEDIATE = 0,
@@ -20,16 +28,121 @@ namespace ptk {
     TIME_NEVER     = (unsigned) -1,
   };
 
+  /*
+   * Compares two 32-bit timestamps, such as the low half of Kernel::now(),
+   * correctly across a wrap as long as they are less than 2^31 ticks apart.
+   */
+  inline bool time_before(ptk_time_t a, ptk_time_t b) {
+    return (int32_t) (a - b) < 0;
+  }
+
+  inline bool time_after(ptk_time_t a, ptk_time_t b) {
+    return time_before(b, a);
+  }
+
   class Timer {
     friend class Kernel;
+    friend class TimerWheel;
     virtual void timer_expired() = 0;
     ptk::i2link_t timer_link;
 
   protected:
     ptk_time_t timer_expiration;
+    uint64_t timer_deadline;
+
+#if defined(PTK_TIMER_WHEEL)
+    uint8_t timer_slot;
+#endif
 
   public:
     Timer();
     void reset();
   };
+
+#if defined(PTK_TIMER_WHEEL)
+  /**
+   * @class TimerWheel
+   * @brief Hierarchical timing wheel holding the armed timers of a Kernel
+   *
+   * The wheel keeps the Kernel's 64-bit tick count, so deadlines are
+   * absolute and never need to be decremented. Level n has SLOTS lists,
+   * each covering (1 << n*BITS) ticks. A timer is filed on the level that
+   * matches the magnitude of its remaining time. When the clock reaches its
+   * slot, it moves down to a finer level, or it expires. Every timer
+   * cascades at most LEVELS times, so arm, disarm and tick all cost O(1)
+   * amortized.
+   *
+   * advance() accepts any time delta. A large jump visits each slot at most
+   * once per level, so it never walks the skipped ticks one by one.
+   */
+  class TimerWheel {
+  public:
+    enum {
+      BITS    = PTK_TIMER_WHEEL_BITS,
+      SLOTS   = 1 << BITS,
+      MASK    = SLOTS - 1,
+      LEVELS  = (32 + BITS - 1) / BITS,
+      NO_SLOT = 0xff
+    };
+
+    /**
+     * @brief list of timers linked through Timer::timer_link
+     */
+    struct List : public I2List<Timer> {
+      List() : I2List<Timer>(&Timer::timer_link) {}
+    };
+
+    TimerWheel();
+
+    /**
+     * @brief files a timer that will expire duration ticks from now
+     *
+     * A duration of zero expires on the next call to advance() that moves
+     * the clock forward.
+     */
+    void insert(Timer &t, ptk_time_t duration);
+
+    /**
+     * @brief files a timer that will expire at tick when
+     *
+     * A deadline that isn't in the future expires on the next call to
+     * advance() that moves the clock forward. when must be less than 2^32
+     * ticks away.
+     */
+    void insert_at(Timer &t, uint64_t when);
+
+    /**
+     * @brief removes a timer, if it is still in the wheel
+     */
+    void remove(Timer &t);
+
+    /**
+     * @brief moves the clock forward and collects the expired timers
+     * @param[in] delta number of ticks that have elapsed
+     * @param[out] expired receives every timer whose deadline has passed
+     *
+     * Each expired timer has its timer_expiration set to the number of
+     * ticks that have elapsed since its deadline.
+     */
+    void advance(ptk_time_t delta, I2List<Timer> &expired);
+
+    const uint64_t &now() const { return clock; }
+
+    /**
+     * @brief ticks until advance() next has work to do
+     * @returns TIME_INFINITE when the wheel is empty
+     *
+     * Timers on the coarser levels cascade before they expire, so this is a
+     * lower bound on the time until the earliest deadline.
+     */
+    ptk_time_t next_expiration() const;
+
+  private:
+    uint64_t clock;
+    uint32_t occupied[LEVELS];
+    List slots[LEVELS * SLOTS];
+
+    void place(Timer &t, uint64_t when);
+  };
+#endif
 }
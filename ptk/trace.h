@@ -0,0 +1,97 @@
+#pragma once
+
+#include "ptk/config.h"
+#include "ptk/port.h"
+#include <stdint.h>
+
+/*
+ * Scheduler trace
+ *
+ * With PTK_TRACE defined, each Kernel keeps a ring of the last
+ * PTK_TRACE_RECORDS things it did, stamped with port::timestamp(). Adding a
+ * record takes one atomic increment and four stores, so interrupt handlers
+ * can record too. The "trace" shell command dumps the ring as text, and
+ * tools/ptk_trace2json turns that dump into Chrome trace JSON for
+ * chrome://tracing or Perfetto.
+ *
+ * Dump format, one record per line after the header, all numbers in hex
+ * except the header's:
+ *
+ *   ptk-trace <version> <timestamp_hz> <record count>
+ *   <kind> <timestamp> <object> <arg>
+ */
+namespace ptk {
+  namespace trace {
+    enum kind_t {
+      DISPATCH_BEGIN  = 1,      // object: thread
+      DISPATCH_END    = 2,      // object: thread, arg: state after running
+      WAKEUP          = 3,      // object: thread, arg: wakeup reason
+      TIMER_ARM       = 4,      // object: timer, arg: duration
+      TIMER_EXPIRE    = 5,      // object: timer, arg: ticks late
+      EVENT_SIGNAL    = 6,      // object: event, arg: mask
+      EVENT_BROADCAST = 7,      // object: event, arg: mask
+      EVENT_POST      = 8,      // object: event, arg: mask
+      ISR_ENTER       = 9,      // arg: nesting depth
+      ISR_LEAVE       = 10,     // arg: nesting depth
+      RUN_OVERRUN     = 11,     // object: thread, arg: cycles over budget
+    };
+
+    enum {
+      VERSION = 1
+    };
+
+    struct Record {
+      uint32_t timestamp;
+      uint32_t object;
+      uint32_t arg;
+      uint8_t kind;
+      uint8_t reserved[3];
+    };
+
+    // how records, and the shell commands that show them, name an object
+    inline uint32_t object_id(const void *object) {
+      return (uint32_t) (uintptr_t) object;
+    }
+
+#if defined(PTK_TRACE)
+    class Buffer {
+    public:
+      enum {
+        RECORDS = PTK_TRACE_RECORDS,
+        MASK    = RECORDS - 1
+      };
+
+      Buffer() : head(0), enabled(true) {}
+
+      void record(kind_t kind, const void *object, uint32_t arg) {
+        if (!enabled) return;
+
+        Record &r = records[__atomic_fetch_add(&head, 1, __ATOMIC_RELAXED) & MASK];
+        r.timestamp = port::timestamp();
+        r.object = object_id(object);
+        r.arg = arg;
+        r.kind = kind;
+      }
+
+      // number of records held, which stops growing once the ring is full
+      unsigned count() const {
+        return head < RECORDS ? head : (unsigned) RECORDS;
+      }
+
+      // n counts from the oldest record still held
+      const Record &get(unsigned n) const {
+        return records[(head - count() + n) & MASK];
+      }
+
+      void clear() { head = 0; }
+      void enable(bool on) { enabled = on; }
+      bool is_enabled() const { return enabled; }
+
+    private:
+      volatile uint32_t head;
+      volatile bool enabled;
+      Record records[RECORDS];
+    };
+#endif
+  }
+}
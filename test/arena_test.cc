@@ -0,0 +1,65 @@
+#include <gtest/gtest.h>
+#include "ptk/arena.h"
+
+using namespace ptk;
+
+struct Pair {
+  int a, b;
+  Pair(int x, int y) : a(x), b(y) {}
+};
+
+TEST(ArenaTest, TestAllocateAndRewind) {
+  StaticArena<64> arena;
+  EXPECT_EQ(64u, arena.capacity());
+  EXPECT_EQ(0u, arena.used());
+
+  char *a = (char *) arena.allocate(10, 1);
+  ASSERT_NE((char *) 0, a);
+  EXPECT_EQ(10u, arena.used());
+
+  Arena::mark_t m = arena.mark();
+  Pair *p = arena.create<Pair>(1, 2);
+  ASSERT_NE((Pair *) 0, p);
+  EXPECT_EQ(0u, (uintptr_t) p % alignof(Pair));
+  EXPECT_EQ(2, p->b);
+  EXPECT_GE((char *) p, a + 10);
+
+  arena.rewind(m);
+  EXPECT_EQ(10u, arena.used());
+  EXPECT_EQ((char *) p, (char *) arena.create<Pair>(3, 4));
+
+  arena.reset();
+  EXPECT_EQ(0u, arena.used());
+  EXPECT_EQ(a, arena.allocate(1, 1));
+}
+
+TEST(ArenaTest, TestFull) {
+  StaticArena<32> arena;
+
+  EXPECT_NE((void *) 0, arena.allocate(30, 1));
+  EXPECT_EQ((void *) 0, arena.allocate(3, 1));
+  EXPECT_NE((void *) 0, arena.allocate(2, 1));
+  EXPECT_EQ(0u, arena.available());
+  EXPECT_EQ((void *) 0, arena.allocate(1, 1));
+}
+
+TEST(ArenaTest, TestScopeAndHighWater) {
+  StaticArena<256> arena;
+  arena.allocate(16);
+
+  {
+    Arena::Scope scope(arena);
+    arena.allocate(100);
+    {
+      Arena::Scope inner(arena);
+      arena.allocate(50);
+    }
+    EXPECT_GE(arena.used(), 116u);
+    EXPECT_LT(arena.used(), 166u);
+  }
+  EXPECT_EQ(16u, arena.used());
+  EXPECT_GE(arena.high_water(), 166u);
+
+  arena.reset_high_water();
+  EXPECT_EQ(16u, arena.high_water());
+}
@@ -0,0 +1,201 @@
+#include <gtest/gtest.h>
+#include "ptk/callback_timer.h"
+#include "ptk/port.h"
+
+using namespace ptk;
+
+struct Counting {
+  int &calls;
+  Counting(int &c) : calls(c) {}
+  void operator()() { calls++; }
+};
+
+// stops its own timer on the third call
+struct Stopper;
+static PeriodicTimer<Stopper> *stopping_timer;
+
+struct Stopper {
+  int &calls;
+  Stopper(int &c) : calls(c) {}
+
+  void operator()() {
+    if (++calls == 3) {
+      lock_from_isr();
+      stopping_timer->stop();
+      unlock_from_isr();
+    }
+  }
+};
+
+// wakes every 4 ticks of absolute time, however long each pass takes
+struct Metronome : public Thread {
+  uint64_t next;
+  uint64_t woke[3];
+  int count;
+
+  Metronome() : next(0), count(0) {}
+
+  virtual void run() {
+    PTK_BEGIN();
+    next = now();
+    while (count < 3) {
+      next += 4;
+      PTK_SLEEP_UNTIL(next);
+      woke[count++] = now();
+    }
+    PTK_END();
+  }
+};
+
+static uint32_t ticks_to_pass;
+
+static void tick() {
+  enter_isr();
+  expire_timers(ticks_to_pass);
+  leave_isr();
+}
+
+class CallbackTimerTest : public ::testing::Test {
+protected:
+  Kernel kernel;
+
+  virtual void SetUp() { the_kernel = &kernel; }
+  virtual void TearDown() { the_kernel = 0; }
+
+  void ticks(uint32_t n, uint32_t step = 1) {
+    ticks_to_pass = step;
+    for (uint32_t i=0; i < n; i += step) port::run_as_interrupt(&tick);
+  }
+};
+
+TEST_F(CallbackTimerTest, TestOneShot) {
+  int calls = 0;
+  CallbackTimer<Counting> t((Counting(calls)));
+
+  kernel.lock();
+  t.start(5);
+  kernel.unlock();
+  EXPECT_TRUE(t.running());
+
+  ticks(4);
+  EXPECT_EQ(calls, 0);
+  ticks(1);
+  EXPECT_EQ(calls, 1);
+  EXPECT_FALSE(t.running());
+
+  ticks(10);
+  EXPECT_EQ(calls, 1);
+}
+
+TEST_F(CallbackTimerTest, TestPeriodic) {
+  int calls = 0;
+  PeriodicTimer<Counting> t((Counting(calls)));
+
+  kernel.lock();
+  t.start(3);
+  kernel.unlock();
+
+  ticks(9);
+  EXPECT_EQ(calls, 3);
+  EXPECT_TRUE(t.running());
+
+  kernel.lock();
+  t.stop();
+  kernel.unlock();
+  ticks(9);
+  EXPECT_EQ(calls, 3);
+  EXPECT_EQ(t.overruns(), 0u);
+}
+
+TEST_F(CallbackTimerTest, TestPeriodicKeepsPhase) {
+  int calls = 0;
+  PeriodicTimer<Counting> t((Counting(calls)));
+
+  kernel.lock();
+  t.start(3);
+  kernel.unlock();
+
+  // due at 3, 6, 9 and 12. A 7 tick jump is late for 3 and misses 6.
+  ticks(7, 7);
+  EXPECT_EQ(calls, 1);
+  EXPECT_EQ(t.overruns(), 1u);
+
+  ticks(1);
+  EXPECT_EQ(calls, 1);
+  ticks(1);
+  EXPECT_EQ(calls, 2);
+  ticks(3);
+  EXPECT_EQ(calls, 3);
+}
+
+TEST_F(CallbackTimerTest, TestPeriodicStopsItself) {
+  int calls = 0;
+  PeriodicTimer<Stopper> t((Stopper(calls)));
+  stopping_timer = &t;
+
+  kernel.lock();
+  t.start(2);
+  kernel.unlock();
+
+  ticks(10);
+  EXPECT_EQ(calls, 3);
+  EXPECT_FALSE(t.running());
+}
+
+TEST_F(CallbackTimerTest, TestNowCounts) {
+  EXPECT_EQ(now(), 0u);
+  ticks(3);
+  ticks(10, 5);
+  EXPECT_EQ(now(), 13u);
+}
+
+TEST_F(CallbackTimerTest, TestArmAt) {
+  int calls = 0;
+  CallbackTimer<Counting> t((Counting(calls)));
+  ticks(100);
+
+  kernel.lock();
+  arm_timer_at(t, now() + 5);
+  EXPECT_EQ(kernel.next_deadline(), 5u);
+  kernel.unlock();
+  ticks(4);
+  EXPECT_EQ(calls, 0);
+  ticks(1);
+  EXPECT_EQ(calls, 1);
+
+  // a deadline already past expires on the next tick
+  kernel.lock();
+  arm_timer_at(t, now() - 10);
+  kernel.unlock();
+  EXPECT_EQ(calls, 1);
+  ticks(1);
+  EXPECT_EQ(calls, 2);
+}
+
+TEST_F(CallbackTimerTest, TestSleepUntilKeepsPhase) {
+  Metronome &m = *new Metronome;
+
+  kernel.lock();
+  kernel.schedule(m);
+  kernel.unlock();
+  while (kernel.run_once()) ;
+
+  // due at 4, 8 and 12. A 6 tick jump makes the first wakeup late.
+  ticks(6, 6);
+  while (kernel.run_once()) ;
+  ticks(2);
+  while (kernel.run_once()) ;
+  ticks(4);
+  while (kernel.run_once()) ;
+  EXPECT_EQ(m.woke[0], 6u);
+  EXPECT_EQ(m.woke[1], 8u);
+  EXPECT_EQ(m.woke[2], 12u);
+}
+
+TEST(TimeTest, TestWrapSafeCompare) {
+  EXPECT_TRUE(time_before(1, 2));
+  EXPECT_FALSE(time_before(2, 2));
+  EXPECT_TRUE(time_before(0xfffffff0u, 0x10));
+  EXPECT_TRUE(time_after(0x10, 0xfffffff0u));
+  EXPECT_FALSE(time_after(0xfffffff0u, 0x10));
+}
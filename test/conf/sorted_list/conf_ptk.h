@@ -0,0 +1,9 @@
+#pragma once
+
+// libptk configuration for the unit tests, with the sorted timer list and
+// the priority-bitmap ready lists
+#define PTK_TIMER_SORTED_LIST
+#define PTK_TRACE
+#define PTK_TRACE_RECORDS 16
+#define PTK_WAKEUP_LATENCY
+#define PTK_RUN_BUDGET 1000000
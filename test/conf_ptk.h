@@ -0,0 +1,9 @@
+#pragma once
+
+// libptk configuration used by the unit tests
+#define PTK_TIMER_WHEEL
+#define PTK_TRACE
+#define PTK_TRACE_RECORDS 16
+#define PTK_WAKEUP_LATENCY
+#define PTK_RUN_BUDGET 1000000
+#define PTK_EDF
@@ -0,0 +1,209 @@
+#include <gtest/gtest.h>
+#include "ptk/cothread.h"
+#include "ptk/port.h"
+
+using namespace ptk;
+
+// Test threads are leaked. Some are still waiting when the fixture's Kernel
+// goes away, and destroying them would need that kernel.
+
+struct Counter : public CoThread {
+  int count;
+
+  Counter() : count(0) {}
+
+  Body body() {
+    // a local that lives across the sleeps
+    for (int i=0; i < 3; ++i) {
+      count = i + 1;
+      co_await sleep(2);
+    }
+  }
+};
+
+struct CoWaiter : public CoThread {
+  Event &event;
+  ptk_time_t timeout;
+  wakeup_t reason;
+
+  CoWaiter(Event &e, ptk_time_t t) : event(e), timeout(t), reason(0) {}
+
+  Body body() {
+    reason = co_await wait(event, timeout);
+  }
+};
+
+struct CoSelector : public CoThread {
+  Event &a, &b;
+  Event *got;
+
+  CoSelector(Event &x, Event &y) : a(x), b(y), got(0) {}
+
+  Body body() {
+    co_await wait({&a, &b}, TIME_INFINITE);
+    got = fired_event();
+  }
+};
+
+struct Child : public SubThread {
+  Event go;
+
+  virtual void run() {
+    PTK_BEGIN();
+    PTK_WAIT_EVENT(go, TIME_INFINITE);
+    PTK_END();
+  }
+};
+
+struct Joiner : public CoThread {
+  Child &child;
+  wakeup_t reason;
+
+  Joiner(Child &c) : child(c), reason(0) {}
+
+  Body body() {
+    reason = co_await join(child, TIME_INFINITE);
+  }
+};
+
+struct TestInStream : public DeviceInStream {
+  uint8_t storage[16];
+
+  TestInStream() : DeviceInStream(storage, sizeof(storage)) {}
+
+  void feed(const char *s) {
+    fifo.write((const uint8_t *) s, strlen(s));
+    device_wrote_to_fifo();
+  }
+};
+
+struct Reader : public CoThread {
+  TestInStream &in;
+  char line[16];
+
+  Reader(TestInStream &s) : in(s) { memset(line, 0, sizeof(line)); }
+
+  Body body() {
+    size_t n = 0;
+    while (n < 6) {
+      size_t got = co_await read(in, (uint8_t *) line + n, 6 - n, TIME_INFINITE);
+      n += got;
+    }
+  }
+};
+
+static void tick() {
+  enter_isr();
+  expire_timers(1);
+  leave_isr();
+}
+
+class CoThreadTest : public ::testing::Test {
+protected:
+  Kernel kernel;
+
+  virtual void SetUp() { the_kernel = &kernel; }
+  virtual void TearDown() { the_kernel = 0; }
+
+  void start(Thread &t) {
+    kernel.lock();
+    kernel.schedule(t);
+    kernel.unlock();
+    run_all();
+  }
+
+  void run_all() {
+    while (kernel.run_once()) ;
+  }
+
+  void ticks(int n) {
+    while (n--) port::run_as_interrupt(&tick);
+    run_all();
+  }
+
+  void signal(Event &e) {
+    kernel.lock();
+    kernel.signal_event(e, WAKEUP_OK);
+    kernel.unlock();
+    run_all();
+  }
+};
+
+TEST_F(CoThreadTest, TestSleepKeepsLocals) {
+  Counter &c = *new Counter;
+  unsigned frames_used = CoThread::frames.used();
+
+  start(c);
+  EXPECT_EQ(c.count, 1);
+  EXPECT_EQ(c.state, SLEEPING_STATE);
+  EXPECT_EQ(CoThread::frames.used(), frames_used + 1);
+
+  ticks(2);
+  EXPECT_EQ(c.count, 2);
+  ticks(2);
+  EXPECT_EQ(c.count, 3);
+
+  // the frame goes back to the pool when the body returns
+  ticks(2);
+  EXPECT_EQ(c.state, FINAL_STATE);
+  EXPECT_EQ(CoThread::frames.used(), frames_used);
+}
+
+TEST_F(CoThreadTest, TestEventWait) {
+  Event event;
+  CoWaiter &signaled = *new CoWaiter(event, TIME_INFINITE);
+  CoWaiter &timed_out = *new CoWaiter(event, 3);
+
+  start(signaled);
+  EXPECT_EQ(signaled.state, WAIT_EVENT_STATE);
+  signal(event);
+  EXPECT_EQ(signaled.reason, WAKEUP_OK);
+  EXPECT_EQ(signaled.state, FINAL_STATE);
+
+  start(timed_out);
+  ticks(3);
+  EXPECT_EQ(timed_out.reason, WAKEUP_TIMEOUT);
+  EXPECT_EQ(timed_out.state, FINAL_STATE);
+}
+
+TEST_F(CoThreadTest, TestWaitEvents) {
+  Event a, b;
+  CoSelector &s = *new CoSelector(a, b);
+
+  start(s);
+  EXPECT_EQ(s.state, WAIT_EVENTS_STATE);
+  signal(b);
+  EXPECT_EQ(s.got, &b);
+  EXPECT_EQ(s.state, FINAL_STATE);
+}
+
+TEST_F(CoThreadTest, TestJoinSubThread) {
+  Child &child = *new Child;
+  Joiner &j = *new Joiner(child);
+
+  start(j);
+  EXPECT_EQ(j.state, WAIT_SUBTHREAD_STATE);
+  EXPECT_EQ(child.state, WAIT_EVENT_STATE);
+
+  signal(child.go);
+  EXPECT_EQ(j.reason, WAKEUP_SUBTHREAD_DONE);
+  EXPECT_EQ(j.state, FINAL_STATE);
+}
+
+TEST_F(CoThreadTest, TestStreamRead) {
+  TestInStream &in = *new TestInStream;
+  Reader &r = *new Reader(in);
+
+  start(r);
+  EXPECT_EQ(r.state, WAIT_EVENT_STATE);
+
+  in.feed("abc");
+  run_all();
+  EXPECT_STREQ(r.line, "abc");
+  EXPECT_EQ(r.state, WAIT_EVENT_STATE);
+
+  in.feed("defgh");
+  run_all();
+  EXPECT_STREQ(r.line, "abcdef");
+  EXPECT_EQ(r.state, FINAL_STATE);
+}
@@ -0,0 +1,131 @@
+#include <gtest/gtest.h>
+#include "ptk/kernel.h"
+#include "ptk/port.h"
+#include <string>
+
+using namespace ptk;
+
+// Test threads are leaked. Some are still waiting when the fixture's Kernel
+// goes away, and destroying them would need that kernel.
+
+static std::string order;
+
+struct Note : public DeferredCall {
+  char name;
+  int calls;
+  bool again;
+
+  Note(char n, priority_t p) : DeferredCall(p), name(n), calls(0), again(false) {}
+
+  virtual void call() {
+    order += name;
+    calls++;
+    if (again) {
+      again = false;
+      defer_call(*this);
+    }
+  }
+};
+
+struct Signaler : public DeferredCall {
+  Event &event;
+
+  Signaler(Event &e) : event(e) {}
+
+  virtual void call() {
+    order += 's';
+    lock_kernel();
+    signal_event(event, 0);
+    unlock_kernel();
+  }
+};
+
+struct Logger : public Thread {
+  Event wake;
+
+  virtual void run() {
+    PTK_BEGIN();
+    PTK_WAIT_EVENT(wake, TIME_INFINITE);
+    order += 't';
+    PTK_END();
+  }
+};
+
+static DeferredCall *to_defer[4];
+
+static void isr() {
+  enter_isr();
+  for (int i=0; i < 4; ++i) {
+    if (to_defer[i]) defer_call(*to_defer[i]);
+  }
+  leave_isr();
+}
+
+class DeferredTest : public ::testing::Test {
+protected:
+  Kernel kernel;
+
+  virtual void SetUp() {
+    the_kernel = &kernel;
+    order.clear();
+    for (int i=0; i < 4; ++i) to_defer[i] = 0;
+  }
+
+  virtual void TearDown() { the_kernel = 0; }
+
+  void interrupt(DeferredCall *a, DeferredCall *b = 0, DeferredCall *c = 0, DeferredCall *d = 0) {
+    to_defer[0] = a;
+    to_defer[1] = b;
+    to_defer[2] = c;
+    to_defer[3] = d;
+    port::run_as_interrupt(&isr);
+  }
+
+  void run_all() {
+    while (kernel.run_once()) ;
+  }
+};
+
+TEST_F(DeferredTest, TestPriorityOrder) {
+  Note low('a', 1), high('b', 6), mid1('c', 3), mid2('d', 3);
+
+  interrupt(&low, &mid1, &high, &mid2);
+  EXPECT_TRUE(low.pending());
+  EXPECT_EQ(order, "");
+
+  run_all();
+  EXPECT_EQ(order, "bcda");
+  EXPECT_FALSE(low.pending());
+}
+
+TEST_F(DeferredTest, TestBurstRunsOnce) {
+  Note n('n', 1);
+
+  interrupt(&n, &n);
+  interrupt(&n);
+  run_all();
+  EXPECT_EQ(n.calls, 1);
+
+  // deferred again from its own call, it runs again on the same pass
+  n.again = true;
+  interrupt(&n);
+  run_all();
+  EXPECT_EQ(n.calls, 3);
+}
+
+TEST_F(DeferredTest, TestRunsBeforeThreads) {
+  Logger &t = *new Logger;
+  Signaler s(t.wake);
+
+  kernel.lock();
+  kernel.schedule(t);
+  kernel.unlock();
+  run_all();
+  EXPECT_EQ(t.state, WAIT_EVENT_STATE);
+
+  // the thread woken by the call runs in the same run_once()
+  interrupt(&s);
+  EXPECT_TRUE(kernel.run_once());
+  EXPECT_EQ(order, "st");
+  EXPECT_EQ(t.state, FINAL_STATE);
+}
@@ -0,0 +1,102 @@
+#include <gtest/gtest.h>
+#include <string.h>
+#include "ptk/kernel.h"
+
+using namespace ptk;
+
+// Test threads are leaked. Some are still waiting when the fixture's Kernel
+// goes away, and destroying them would need that kernel.
+
+#if defined(PTK_EDF)
+
+static char order[16];
+static int order_length;
+
+struct Periodic : public Thread {
+  char name;
+
+  Periodic(char n, ptk_time_t deadline, priority_t p = PTK_DEFAULT_PRIORITY) :
+    Thread(p), name(n)
+  {
+    set_deadline(deadline);
+  }
+
+  virtual void run() {
+    PTK_BEGIN();
+    PTK_SLEEP(2);
+    order[order_length++] = name;
+    PTK_END();
+  }
+};
+
+static void edf_tick() {
+  enter_isr();
+  expire_timers(1);
+  leave_isr();
+}
+
+class EdfTest : public ::testing::Test {
+protected:
+  Kernel kernel;
+
+  virtual void SetUp() {
+    the_kernel = &kernel;
+    order_length = 0;
+    memset(order, 0, sizeof(order));
+  }
+
+  virtual void TearDown() { the_kernel = 0; }
+
+  void start(Thread &t) {
+    kernel.lock();
+    kernel.schedule(t);
+    kernel.unlock();
+  }
+
+  void run_all() {
+    while (kernel.run_once()) ;
+  }
+
+  void ticks(int n) {
+    while (n--) port::run_as_interrupt(&edf_tick);
+  }
+};
+
+TEST_F(EdfTest, TestEarliestDeadlineFirst) {
+  // all four wake on the same tick
+  start(*new Periodic('a', TIME_INFINITE));
+  start(*new Periodic('b', 30));
+  start(*new Periodic('c', TIME_INFINITE));
+  start(*new Periodic('d', 10));
+  start(*new Periodic('e', 20));
+  run_all();
+
+  ticks(2);
+  run_all();
+  EXPECT_STREQ("debac", order);
+}
+
+TEST_F(EdfTest, TestPriorityComesFirst) {
+  start(*new Periodic('a', 10));
+  start(*new Periodic('b', 50, PTK_DEFAULT_PRIORITY + 1));
+  run_all();
+
+  ticks(2);
+  run_all();
+  EXPECT_STREQ("ba", order);
+}
+
+TEST_F(EdfTest, TestDeadlineCountsFromWakeup) {
+  // a wakes at tick 2, due at 7, and b wakes at tick 3, due at 6
+  start(*new Periodic('a', 5));
+  run_all();
+  ticks(1);
+  start(*new Periodic('b', 3));
+  run_all();
+
+  ticks(2);
+  run_all();
+  EXPECT_STREQ("ba", order);
+}
+
+#endif
@@ -0,0 +1,98 @@
+#include <gtest/gtest.h>
+#include <stdlib.h>
+#include "ptk/iheap.h"
+
+using namespace ptk;
+
+struct HeapElement {
+  iheaplink_t l;
+  int key;
+
+  HeapElement(int k = 0) : key(k) {}
+};
+
+struct KeyOrder {
+  bool operator()(const HeapElement &a, const HeapElement &b) const {
+    return a.key < b.key;
+  }
+};
+
+typedef IHeap<HeapElement, 64, KeyOrder> TestHeap;
+
+TEST(IHeapTest, TestEmpty) {
+  TestHeap heap(&HeapElement::l);
+  HeapElement e(1);
+
+  EXPECT_TRUE(heap.empty());
+  EXPECT_EQ(0, heap.pop());
+  EXPECT_EQ(0, heap.front());
+  EXPECT_FALSE(heap.contains(e));
+  heap.remove(e);
+  EXPECT_TRUE(heap.empty());
+}
+
+TEST(IHeapTest, TestPopsInOrder) {
+  TestHeap heap(&HeapElement::l);
+  HeapElement e[5] = { 30, 10, 50, 20, 40 };
+
+  for (int i=0; i < 5; ++i) heap.push(e[i]);
+  EXPECT_EQ(5u, heap.size());
+  EXPECT_EQ(&e[1], heap.front());
+
+  int last = 0;
+  while (HeapElement *top = heap.pop()) {
+    EXPECT_LT(last, top->key);
+    EXPECT_FALSE(heap.contains(*top));
+    last = top->key;
+  }
+  EXPECT_EQ(50, last);
+}
+
+TEST(IHeapTest, TestRemoveAndUpdate) {
+  TestHeap heap(&HeapElement::l);
+  HeapElement e[5] = { 30, 10, 50, 20, 40 };
+
+  for (int i=0; i < 5; ++i) heap.push(e[i]);
+  heap.remove(e[3]);
+  EXPECT_FALSE(heap.contains(e[3]));
+
+  e[2].key = 5;
+  heap.update(e[2]);
+  e[1].key = 45;
+  heap.update(e[1]);
+
+  EXPECT_EQ(&e[2], heap.pop());
+  EXPECT_EQ(&e[0], heap.pop());
+  EXPECT_EQ(&e[4], heap.pop());
+  EXPECT_EQ(&e[1], heap.pop());
+  EXPECT_TRUE(heap.empty());
+}
+
+TEST(IHeapTest, TestMatchesSort) {
+  TestHeap heap(&HeapElement::l);
+  HeapElement e[64];
+
+  srand(1);
+  for (int round=0; round < 100; ++round) {
+    for (int i=0; i < 64; ++i) {
+      e[i].key = rand() % 1000;
+      heap.push(e[i]);
+    }
+
+    // take out a random half, and change the keys of some of the rest
+    for (int i=0; i < 64; i += 2) heap.remove(e[rand() % 64]);
+    for (int i=1; i < 64; i += 4) {
+      e[i].key = rand() % 1000;
+      heap.update(e[i]);
+    }
+
+    int last = -1;
+    unsigned count = heap.size();
+    while (HeapElement *top = heap.pop()) {
+      EXPECT_LE(last, top->key);
+      last = top->key;
+      count--;
+    }
+    EXPECT_EQ(0u, count);
+  }
+}
@@ -395,3 +395,63 @@ TEST_F(I2ListTest, Iter123rn) {
 }
 
 
+
+TEST_F(I2ListTest, TestInsertBefore) {
+  list.push_back(e1);
+  list.push_back(e3);
+  list.insert_before(e2, e3);
+  list.insert_before(e4, e1);
+
+  EXPECT_EQ(value(list), 4123);
+  EXPECT_EQ(list.front(), &e4);
+}
+
+TEST_F(I2ListTest, TestNext) {
+  EXPECT_EQ(list.front(), (TestElement *) 0);
+  EXPECT_EQ(list.next(e1), (TestElement *) 0);
+
+  list.push_back(e1);
+  EXPECT_EQ(list.next(e1), (TestElement *) 0);
+
+  list.push_back(e2);
+  list.push_back(e3);
+  EXPECT_EQ(list.next(e1), &e2);
+  EXPECT_EQ(list.next(e2), &e3);
+  EXPECT_EQ(list.next(e3), (TestElement *) 0);
+  EXPECT_EQ(list.next(e4), (TestElement *) 0);
+}
+
+TEST_F(I2ListTest, TestBack) {
+  EXPECT_EQ(list.back(), (TestElement *) 0);
+
+  list.push_back(e1);
+  EXPECT_EQ(list.back(), &e1);
+
+  list.push_back(e2);
+  list.push(e3);
+  EXPECT_EQ(list.back(), &e2);
+  EXPECT_EQ(list.front(), &e3);
+}
+
+TEST_F(I2ListTest, TestSpliceBack) {
+  I2List<TestElement> other(&TestElement::l);
+
+  list.splice_back(other);
+  EXPECT_TRUE(list.empty());
+
+  other.push_back(e1);
+  list.splice_back(other);
+  EXPECT_TRUE(other.empty());
+  EXPECT_EQ(list.front(), &e1);
+  EXPECT_EQ(list.back(), &e1);
+
+  other.push_back(e2);
+  other.push_back(e3);
+  list.splice_back(other);
+  EXPECT_TRUE(other.empty());
+  EXPECT_EQ(list.front(), &e1);
+  EXPECT_EQ(list.next(e1), &e2);
+  EXPECT_EQ(list.next(e2), &e3);
+  EXPECT_EQ(list.back(), &e3);
+  EXPECT_EQ(value(list), 123);
+}
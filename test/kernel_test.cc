@@ -0,0 +1,386 @@
+#include <gtest/gtest.h>
+#include "ptk/kernel.h"
+#include "ptk/port.h"
+#include <string>
+
+using namespace ptk;
+
+// Test threads are leaked. Some are still waiting when the fixture's Kernel
+// goes away, and destroying them would need that kernel.
+
+static std::string trail;
+
+struct Napper : public Thread {
+  ptk_time_t nap;
+  int naps;
+
+  Napper(ptk_time_t n) : nap(n), naps(0) {}
+
+  virtual void run() {
+    PTK_BEGIN();
+    for (;;) {
+      PTK_SLEEP(nap);
+      naps++;
+    }
+    PTK_END();
+  }
+};
+
+struct Listener : public Thread {
+  Event &event;
+  char mark;
+
+  Listener(Event &e, char m) : event(e), mark(m) {}
+
+  virtual void run() {
+    PTK_BEGIN();
+    for (;;) {
+      PTK_WAIT_EVENT(event, TIME_INFINITE);
+      trail += mark;
+    }
+    PTK_END();
+  }
+};
+
+// marks the trail on each of its laps, yielding in between
+struct Spinner : public Thread {
+  char mark;
+  int laps;
+
+  Spinner(char m, priority_t p, int n = 1) : Thread(p), mark(m), laps(n) {}
+
+  virtual void run() {
+    PTK_BEGIN();
+    while (laps > 0) {
+      laps--;
+      trail += mark;
+      PTK_YIELD();
+    }
+    PTK_END();
+  }
+};
+
+// holds a mutex for two laps
+struct Holder : public Thread {
+  Mutex &mutex;
+
+  Holder(Mutex &m, priority_t p) : Thread(p), mutex(m) {}
+
+  virtual void run() {
+    PTK_BEGIN();
+    PTK_MUTEX_LOCK(mutex, TIME_INFINITE);
+    trail += 'h';
+    PTK_YIELD();
+    trail += 'h';
+    PTK_YIELD();
+    PTK_MUTEX_UNLOCK(mutex);
+    trail += 'H';
+    PTK_END();
+  }
+};
+
+struct Grabber : public Thread {
+  Mutex &mutex;
+
+  Grabber(Mutex &m, priority_t p) : Thread(p), mutex(m) {}
+
+  virtual void run() {
+    PTK_BEGIN();
+    PTK_MUTEX_LOCK(mutex, TIME_INFINITE);
+    trail += 'g';
+    PTK_MUTEX_UNLOCK(mutex);
+    PTK_END();
+  }
+};
+
+// a tick interrupt in the middle of its run
+struct Ticker : public Thread {
+  virtual void run();
+};
+
+// destroys the threads it's given, which may be in its own batch
+struct Wrecker : public Thread {
+  Thread *victims[2];
+
+  Wrecker(Thread *a, Thread *b) {
+    victims[0] = a;
+    victims[1] = b;
+  }
+
+  virtual void run() {
+    PTK_BEGIN();
+    delete victims[0];
+    delete victims[1];
+    trail += 'w';
+    PTK_END();
+  }
+};
+
+static void burn_a_millisecond() {
+  const uint32_t begin = port::timestamp();
+  while (port::timestamp() - begin < 1000000) ;
+}
+
+// takes a millisecond on every run
+struct Burner : public Thread {
+  virtual void run() {
+    PTK_BEGIN();
+    for (;;) {
+      burn_a_millisecond();
+      trail += 'b';
+      PTK_YIELD();
+    }
+    PTK_END();
+  }
+};
+
+struct Chore : public DeferredCall {
+  virtual void call() { trail += 'c'; }
+};
+
+// what the idle hook was called with, and what "arrives" while it sleeps
+static int idle_calls;
+static ptk_time_t idle_duration;
+static DeferredCall *defer_in_idle;
+static Event *post_in_idle;
+
+static void fake_idle(ptk_time_t duration) {
+  idle_calls++;
+  idle_duration = duration;
+  trail += 'i';
+
+  // like a handler above the kernel's interrupt mask, which can still
+  // defer and post while the kernel is locked
+  if (defer_in_idle) the_kernel->defer(*defer_in_idle);
+  if (post_in_idle) the_kernel->post_event(*post_in_idle, WAKEUP_OK);
+  defer_in_idle = 0;
+  post_in_idle = 0;
+}
+
+static uint32_t kernel_ticks;
+static DeferredCall *isr_call;
+static Event *isr_event;
+
+static void kernel_isr() {
+  enter_isr();
+  if (kernel_ticks) expire_timers(kernel_ticks);
+  if (isr_call) defer_call(*isr_call);
+  if (isr_event) post_event(*isr_event, WAKEUP_OK);
+  leave_isr();
+}
+
+void Ticker::run() {
+  PTK_BEGIN();
+  kernel_ticks = 1;
+  isr_call = 0;
+  isr_event = 0;
+  port::run_as_interrupt(&kernel_isr);
+  PTK_END();
+}
+
+class KernelTest : public ::testing::Test {
+protected:
+  Kernel kernel;
+
+  virtual void SetUp() {
+    the_kernel = &kernel;
+    trail.clear();
+    idle_calls = 0;
+    idle_duration = 0;
+    defer_in_idle = 0;
+    post_in_idle = 0;
+  }
+
+  virtual void TearDown() { the_kernel = 0; }
+
+  void start(Thread &t) {
+    kernel.lock();
+    kernel.schedule(t);
+    kernel.unlock();
+  }
+
+  void interrupt(uint32_t ticks, DeferredCall *call = 0, Event *event = 0) {
+    kernel_ticks = ticks;
+    isr_call = call;
+    isr_event = event;
+    port::run_as_interrupt(&kernel_isr);
+  }
+};
+
+TEST_F(KernelTest, TestIdleGetsNextDeadline) {
+  kernel.set_idle_hook(&fake_idle);
+
+  // with no timer armed, sleep until an interrupt
+  EXPECT_FALSE(kernel.run_once());
+  EXPECT_EQ(idle_calls, 1);
+  EXPECT_EQ(idle_duration, (ptk_time_t) TIME_INFINITE);
+
+  Napper &n = *new Napper(7);
+  start(n);
+  EXPECT_TRUE(kernel.run_once());
+  EXPECT_EQ(idle_calls, 1);
+
+  EXPECT_FALSE(kernel.run_once());
+  EXPECT_EQ(idle_calls, 2);
+  EXPECT_EQ(idle_duration, 7u);
+
+  // woken early, with part of the nap left
+  interrupt(3);
+  EXPECT_FALSE(kernel.run_once());
+  EXPECT_EQ(idle_duration, 4u);
+}
+
+TEST_F(KernelTest, TestClockAdvancesBySleep) {
+  kernel.set_idle_hook(&fake_idle);
+  Napper &n = *new Napper(5);
+  start(n);
+  while (kernel.run_once()) ;
+  EXPECT_EQ(idle_duration, 5u);
+
+  // the port reports the ticks it slept through, which wakes the thread
+  interrupt(idle_duration);
+  EXPECT_EQ(kernel.now(), 5u);
+  EXPECT_TRUE(kernel.run_once());
+  EXPECT_EQ(n.naps, 1);
+
+  EXPECT_FALSE(kernel.run_once());
+  EXPECT_EQ(idle_duration, 5u);
+  interrupt(idle_duration);
+  EXPECT_EQ(kernel.now(), 10u);
+  EXPECT_TRUE(kernel.run_once());
+  EXPECT_EQ(n.naps, 2);
+}
+
+TEST_F(KernelTest, TestNoIdleWhileWorkPending) {
+  kernel.set_idle_hook(&fake_idle);
+  Event event;
+  Chore chore;
+  Listener &l = *new Listener(event, 't');
+  start(l);
+  EXPECT_TRUE(kernel.run_once());
+
+  // an interrupt left a call and a post for the kernel
+  interrupt(0, &chore, &event);
+  EXPECT_TRUE(kernel.run_once());
+  EXPECT_EQ(trail, "ct");
+  EXPECT_EQ(idle_calls, 0);
+
+  // and here they come in while the kernel idles, so the next pass takes
+  // them before idling again
+  defer_in_idle = &chore;
+  post_in_idle = &event;
+  EXPECT_FALSE(kernel.run_once());
+  EXPECT_TRUE(kernel.run_once());
+  EXPECT_EQ(trail, "ctict");
+  EXPECT_EQ(idle_calls, 1);
+
+  // only a deferred call, which readies no thread
+  defer_in_idle = &chore;
+  EXPECT_FALSE(kernel.run_once());
+  EXPECT_FALSE(kernel.run_once());
+  EXPECT_EQ(trail, "ctictici");
+  EXPECT_EQ(idle_calls, 3);
+}
+
+TEST_F(KernelTest, TestPriorityOrder) {
+  start(*new Spinner('a', 1));
+  start(*new Spinner('b', 5));
+  start(*new Spinner('c', 3));
+  start(*new Spinner('d', 5));
+  start(*new Spinner('e', 0));
+  start(*new Spinner('f', PTK_PRIORITY_LEVELS - 1));
+  while (kernel.run_once()) ;
+  EXPECT_EQ(trail, "fbdcae");
+}
+
+TEST_F(KernelTest, TestRoundRobinWithinLevel) {
+  start(*new Spinner('z', 2));
+  start(*new Spinner('x', 4, 3));
+  start(*new Spinner('y', 4, 3));
+  while (kernel.run_once()) ;
+  EXPECT_EQ(trail, "xyxyxyz");
+
+  // a thread readied at the level joins the back of the rotation, behind
+  // the one that has just had its turn
+  trail.clear();
+  start(*new Spinner('p', 4, 2));
+  start(*new Spinner('q', 4, 2));
+  EXPECT_TRUE(kernel.run_once());
+  start(*new Spinner('r', 4, 2));
+  while (kernel.run_once()) ;
+  EXPECT_EQ(trail, "pqprqr");
+}
+
+TEST_F(KernelTest, TestSetPriorityWhileReady) {
+  Mutex mutex;
+  Holder &h = *new Holder(mutex, 1);
+  start(h);
+  EXPECT_TRUE(kernel.run_once());
+  EXPECT_EQ(trail, "h");
+
+  // the grabber blocks and lends its priority to the holder, which is
+  // still on the ready list for level 1
+  start(*new Spinner('b', 3, 3));
+  start(*new Grabber(mutex, 6));
+  EXPECT_TRUE(kernel.run_once());
+  EXPECT_EQ(h.priority, 6);
+  EXPECT_EQ(trail, "h");
+
+  while (kernel.run_once()) ;
+  EXPECT_EQ(trail, "hhHgbbb");
+  EXPECT_EQ(h.priority, 1);
+}
+
+TEST_F(KernelTest, TestRunBatchWakesEarlierThread) {
+  // the napper sleeps, and the ticker later in the same batch wakes it
+  Napper &n = *new Napper(1);
+  start(n);
+  start(*new Ticker);
+  EXPECT_EQ(kernel.run(PTK_RUN_BATCH), 3u);
+  EXPECT_EQ(n.naps, 1);
+
+  // the napper went on the ready list once, and the lists still hold up
+  EXPECT_EQ(kernel.run(PTK_RUN_BATCH), 0u);
+  interrupt(1);
+  EXPECT_EQ(kernel.run(PTK_RUN_BATCH), 1u);
+  EXPECT_EQ(n.naps, 2);
+  EXPECT_FALSE(kernel.run_once());
+}
+
+TEST_F(KernelTest, TestRunBatchSkipsDestroyed) {
+  // one victim has had its turn and yielded, the other hasn't run yet
+  Spinner *ran = new Spinner('r', PTK_DEFAULT_PRIORITY, 2);
+  Spinner *waiting = new Spinner('x', PTK_DEFAULT_PRIORITY);
+  start(*ran);
+  start(*new Wrecker(ran, waiting));
+  start(*waiting);
+
+  EXPECT_EQ(kernel.run(PTK_RUN_BATCH), 2u);
+  EXPECT_EQ(trail, "rw");
+  EXPECT_FALSE(kernel.run_once());
+}
+
+TEST_F(KernelTest, TestRunThreadBudget) {
+  start(*new Spinner('a', 1, 100));
+  start(*new Spinner('b', 1, 100));
+  start(*new Spinner('c', 1, 100));
+
+  EXPECT_EQ(kernel.run(2), 2u);
+  EXPECT_EQ(trail, "ab");
+
+  // several batches, the last one cut short
+  EXPECT_EQ(kernel.run(2 * PTK_RUN_BATCH + 1), 2u * PTK_RUN_BATCH + 1);
+  EXPECT_EQ(trail.size(), 2u * PTK_RUN_BATCH + 3);
+  EXPECT_EQ(trail.substr(0, 6), "abcabc");
+}
+
+TEST_F(KernelTest, TestRunTimeBudget) {
+  for (int i=0; i < 4; ++i) start(*new Burner);
+
+  // the budget is only checked between batches, so the first one finishes
+  EXPECT_EQ(kernel.run(100, 1000000), 4u);
+  EXPECT_EQ(trail, "bbbb");
+
+  // no time limit
+  EXPECT_EQ(kernel.run(10), 10u);
+}
@@ -0,0 +1,237 @@
+#include <gtest/gtest.h>
+#include "ptk/kernel.h"
+#include "ptk/pool.h"
+#include "ptk/port.h"
+
+#include <thread>
+#include <vector>
+
+using namespace ptk;
+
+struct Counted {
+  static int alive;
+  int value;
+
+  Counted(int v) : value(v) { alive++; }
+  ~Counted() { alive--; }
+};
+
+int Counted::alive = 0;
+
+TEST(PoolTest, TestCreateAndDestroy) {
+  Pool<Counted, 3> pool;
+  EXPECT_EQ(3u, pool.available());
+
+  Counted *a = pool.create(1);
+  Counted *b = pool.create(2);
+  Counted *c = pool.create(3);
+  EXPECT_EQ(0, pool.create(4));
+  EXPECT_EQ(0u, pool.available());
+  EXPECT_EQ(3, Counted::alive);
+  EXPECT_EQ(2, b->value);
+
+  pool.destroy(b);
+  EXPECT_EQ(2, Counted::alive);
+  EXPECT_EQ(1u, pool.available());
+
+  // the block that was freed last is handed out first
+  Counted *d = pool.create(5);
+  EXPECT_EQ(b, d);
+
+  pool.destroy(a);
+  pool.destroy(c);
+  pool.destroy(d);
+  EXPECT_EQ(0, Counted::alive);
+  EXPECT_EQ(3u, pool.available());
+}
+
+struct Handler : public SubThread {
+  static int finished;
+  int steps;
+
+  Handler(int s) : steps(s) {}
+  virtual ~Handler() { finished++; }
+
+  virtual void run() {
+    PTK_BEGIN();
+    while (steps-- > 0) PTK_YIELD();
+    PTK_END();
+  }
+};
+
+int Handler::finished = 0;
+
+struct Dispatcher : public Thread {
+  ThreadPool<Handler, 2> &pool;
+  int requests, refused;
+  Handler *h;
+
+  Dispatcher(ThreadPool<Handler, 2> &p, int r) : pool(p), requests(r), refused(0) {}
+
+  virtual void run() {
+    PTK_BEGIN();
+    while (requests-- > 0) {
+      h = pool.spawn(requests % 3);
+      if (h == 0) {
+        refused++;
+      } else {
+        PTK_WAIT_SUBTHREAD(*h, TIME_INFINITE);
+      }
+    }
+    PTK_END();
+  }
+};
+
+struct Waiter : public Thread {
+  Event &event;
+
+  Waiter(Event &e) : event(e) {}
+
+  virtual void run() {
+    PTK_BEGIN();
+    PTK_WAIT_EVENT(event, 100);
+    PTK_END();
+  }
+};
+
+class ThreadPoolTest : public ::testing::Test {
+protected:
+  Kernel kernel;
+
+  virtual void SetUp() { the_kernel = &kernel; }
+  virtual void TearDown() { the_kernel = 0; }
+
+  void start(Thread &t) {
+    kernel.lock();
+    kernel.schedule(t);
+    kernel.unlock();
+  }
+
+  void run_all() {
+    while (kernel.run_once()) ;
+  }
+
+  bool registered(Thread *t) {
+    for (Thread *i = all_registered_threads; i; i = i->next_registered_thread) {
+      if (i == t) return true;
+    }
+    return false;
+  }
+};
+
+TEST_F(ThreadPoolTest, TestSubThreadsAreReaped) {
+  ThreadPool<Handler, 2> pool;
+  Dispatcher dispatcher(pool, 50);
+  Handler::finished = 0;
+
+  start(dispatcher);
+  run_all();
+
+  EXPECT_EQ(FINAL_STATE, dispatcher.state);
+  EXPECT_EQ(50, Handler::finished);
+  EXPECT_EQ(0, dispatcher.refused);
+  EXPECT_EQ(2u, pool.available());
+}
+
+TEST_F(ThreadPoolTest, TestReapedWithRun) {
+  ThreadPool<Handler, 2> pool;
+  Handler::finished = 0;
+
+  start(*pool.spawn(3));
+  start(*pool.spawn(1));
+  EXPECT_EQ(0u, pool.available());
+
+  while (kernel.run(100)) ;
+  EXPECT_EQ(2, Handler::finished);
+  EXPECT_EQ(2u, pool.available());
+}
+
+TEST_F(ThreadPoolTest, TestDestroyWaitingThread) {
+  Event event;
+  Waiter *a = new Waiter(event);
+  Waiter *b = new Waiter(event);
+  Waiter *c = new Waiter(event);
+
+  start(*a);
+  start(*b);
+  start(*c);
+  run_all();
+  EXPECT_TRUE(registered(b));
+
+  // b leaves the middle of the wait list, and its timer
+  delete b;
+  EXPECT_FALSE(registered(b));
+  EXPECT_TRUE(registered(a));
+  EXPECT_TRUE(registered(c));
+
+  kernel.lock();
+  kernel.broadcast_event(event, 0);
+  kernel.unlock();
+  run_all();
+  EXPECT_EQ(FINAL_STATE, a->state);
+  EXPECT_EQ(FINAL_STATE, c->state);
+
+  delete a;
+  delete c;
+  EXPECT_FALSE(registered(a));
+  EXPECT_FALSE(registered(c));
+}
+
+TEST_F(ThreadPoolTest, TestDestroyReadyThread) {
+  Event event;
+  Waiter *a = new Waiter(event);
+  Waiter *b = new Waiter(event);
+
+  start(*a);
+  start(*b);
+  delete a;
+  run_all();
+  EXPECT_EQ(WAIT_EVENT_STATE, b->state);
+
+  delete b;
+  EXPECT_FALSE(kernel.run_once());
+}
+
+TEST(PoolTest, TestHighWater) {
+  Pool<int, 4> pool;
+  int *a = pool.create(1);
+  int *b = pool.create(2);
+  int *c = pool.create(3);
+  pool.destroy(b);
+  pool.destroy(a);
+
+  EXPECT_EQ(1u, pool.used());
+  EXPECT_EQ(3u, pool.high_water());
+  pool.reset_high_water();
+  EXPECT_EQ(1u, pool.high_water());
+  pool.destroy(c);
+}
+
+TEST(PoolTest, TestConcurrentUse) {
+  enum { THREADS = 4, ROUNDS = 20000, HELD = 8 };
+  static Pool<int, THREADS * HELD> pool;
+  std::vector<std::thread> threads;
+  volatile bool broken = false;
+
+  // every block any thread holds must be unique, or the stack got corrupted
+  for (int t=0; t < THREADS; ++t) {
+    threads.push_back(std::thread([t, &broken]() {
+      int *held[HELD];
+      for (int round=0; round < ROUNDS; ++round) {
+        for (int i=0; i < HELD; ++i) {
+          held[i] = pool.create(t * HELD + i);
+          if (held[i] == 0) broken = true;
+        }
+        for (int i=0; i < HELD; ++i) {
+          if (held[i] && *held[i] != t * HELD + i) broken = true;
+          if (held[i]) pool.destroy(held[i]);
+        }
+      }
+    }));
+  }
+  for (auto &t : threads) t.join();
+
+  EXPECT_FALSE(broken);
+  EXPECT_EQ(0u, pool.used());
+  EXPECT_EQ((unsigned) THREADS * HELD, pool.available());
+}
@@ -0,0 +1,156 @@
+#include <gtest/gtest.h>
+#include "ptk/kernel.h"
+#include "ptk/port.h"
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+#include <thread>
+
+using namespace ptk;
+
+// Test threads are leaked. Some are still waiting when the fixture's Kernel
+// goes away, and destroying them would need that kernel.
+
+#if defined(PTK_PORT_LINUX)
+
+struct Dozer : public Thread {
+  ptk_time_t nap;
+  uint64_t woke_at;
+
+  Dozer(ptk_time_t n) : nap(n), woke_at(0) {}
+
+  virtual void run() {
+    PTK_BEGIN();
+    PTK_SLEEP(nap);
+    woke_at = now();
+    PTK_END();
+  }
+};
+
+static volatile int outer_runs, inner_runs;
+static volatile int inner_runs_in_lock;
+static volatile int inner_nesting;
+
+// as if raised by a device, but synchronously on this thread
+static void raise_here(int signo) {
+  pthread_kill(pthread_self(), signo);
+}
+
+static void inner_isr() {
+  inner_runs++;
+  inner_nesting = port::isr_nesting;
+}
+
+static void outer_isr() {
+  outer_runs++;
+  enter_isr();
+  lock_from_isr();
+  raise_here(SIGRTMIN);
+  inner_runs_in_lock = inner_runs;
+  unlock_from_isr();
+  leave_isr();
+}
+
+class PortTest : public ::testing::Test {
+protected:
+  Kernel kernel;
+
+  virtual void SetUp() {
+    the_kernel = &kernel;
+    outer_runs = 0;
+    inner_runs = 0;
+    inner_runs_in_lock = -1;
+    inner_nesting = 0;
+    port::attach_interrupt(SIGUSR2, &outer_isr);
+    port::attach_interrupt(SIGRTMIN, &inner_isr);
+  }
+
+  virtual void TearDown() { the_kernel = 0; }
+};
+
+TEST_F(PortTest, TestPendingRunsOnUnlock) {
+  kernel.lock();
+  raise_here(SIGRTMIN);
+  EXPECT_EQ(inner_runs, 0);
+  EXPECT_TRUE(port::interrupts_pending);
+  kernel.unlock();
+
+  EXPECT_EQ(inner_runs, 1);
+  EXPECT_EQ(inner_nesting, 1);
+  EXPECT_FALSE(port::interrupts_pending);
+  EXPECT_FALSE(port::in_isr());
+
+  // with nothing masked, it runs straight away
+  raise_here(SIGRTMIN);
+  EXPECT_EQ(inner_runs, 2);
+}
+
+TEST_F(PortTest, TestNestedInterrupt) {
+  // the outer handler's own critical section holds the inner one off, and
+  // its end lets the inner one in while the outer is still active
+  kernel.lock();
+  raise_here(SIGUSR2);
+  EXPECT_EQ(outer_runs, 0);
+  kernel.unlock();
+
+  EXPECT_EQ(outer_runs, 1);
+  EXPECT_EQ(inner_runs_in_lock, 0);
+  EXPECT_EQ(inner_runs, 1);
+  EXPECT_EQ(inner_nesting, 2);
+  EXPECT_FALSE(port::in_isr());
+}
+
+TEST_F(PortTest, TestNestedLockAsserts) {
+  // kernel critical sections don't nest
+  EXPECT_DEATH({
+    kernel.lock();
+    kernel.lock();
+  }, "already locked");
+}
+
+TEST_F(PortTest, TestIdleWakesOnInterrupt) {
+  // a slow tick, so that only the raised interrupt can end the sleep
+  port::start(1000000);
+
+  // sleeps with the kernel locked, as in run_once(), until another
+  // thread raises an interrupt
+  std::thread raiser([] {
+    usleep(20000);
+    port::raise_interrupt(SIGRTMIN);
+  });
+
+  kernel.lock();
+  port::idle(TIME_INFINITE);
+  EXPECT_EQ(inner_runs, 0);
+  kernel.unlock();
+  EXPECT_EQ(inner_runs, 1);
+
+  raiser.join();
+  port::stop();
+}
+
+TEST_F(PortTest, TestIdleSleepsToDeadline) {
+  Dozer &d = *new Dozer(20);
+  kernel.set_idle_hook(&port::idle);
+  port::start(1000);
+
+  kernel.lock();
+  kernel.schedule(d);
+  kernel.unlock();
+
+  // a handful of passes, not one per tick, before the thread wakes
+  const uint32_t begin = port::timestamp();
+  int passes = 0;
+  while (d.woke_at == 0 && passes < 100) {
+    kernel.run_once();
+    passes++;
+  }
+  const uint32_t elapsed = port::timestamp() - begin;
+  port::stop();
+
+  EXPECT_GE(d.woke_at, 20u);
+  EXPECT_LT(passes, 10);
+  EXPECT_GE(elapsed, 19u * 1000000u);
+}
+
+#endif
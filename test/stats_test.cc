@@ -0,0 +1,189 @@
+#include <gtest/gtest.h>
+#include "ptk/kernel.h"
+
+using namespace ptk;
+
+// Test threads are leaked. Some are still waiting when the fixture's Kernel
+// goes away, and destroying them would need that kernel.
+
+// the test threads advance this clock by the time they pretend to take
+static uint32_t fake_cycles;
+
+static uint32_t read_fake_cycles() {
+  return fake_cycles;
+}
+
+struct Worker : public Thread {
+  Event &event;
+  uint32_t cost[3];
+  int step;
+
+  Worker(Event &e) : event(e), step(0) {
+    cost[0] = 5;
+    cost[1] = 20;
+    cost[2] = 7;
+  }
+
+  virtual void run() {
+    fake_cycles += cost[step++];
+    PTK_BEGIN();
+    PTK_SLEEP(1);
+    PTK_WAIT_EVENT(event, TIME_INFINITE);
+    PTK_END();
+  }
+};
+
+static void stats_tick() {
+  enter_isr();
+  expire_timers(1);
+  leave_isr();
+}
+
+class StatsTest : public ::testing::Test {
+protected:
+  Kernel kernel;
+
+  virtual void SetUp() {
+    the_kernel = &kernel;
+    kernel.set_cycle_counter(&read_fake_cycles);
+    fake_cycles = 0xfffffff0;
+  }
+
+  virtual void TearDown() { the_kernel = 0; }
+
+  void run_all() {
+    while (kernel.run_once()) ;
+  }
+};
+
+TEST_F(StatsTest, TestRunTimesAndWakeups) {
+  Event event;
+  Worker &w = *new Worker(event);
+
+  kernel.lock();
+  kernel.schedule(w);
+  kernel.unlock();
+  run_all();
+
+  EXPECT_EQ(1u, w.stats.runs);
+  EXPECT_EQ(5u, w.stats.total_time);
+
+  // the counter wraps during this run
+  port::run_as_interrupt(&stats_tick);
+  run_all();
+
+  EXPECT_EQ(2u, w.stats.runs);
+  EXPECT_EQ(1u, w.stats.wakeups_timeout);
+  EXPECT_EQ(0u, w.stats.wakeups_ok);
+
+  kernel.lock();
+  kernel.signal_event(event, 0);
+  kernel.unlock();
+  run_all();
+
+  EXPECT_EQ(FINAL_STATE, w.state);
+  EXPECT_EQ(3u, w.stats.runs);
+  EXPECT_EQ(32u, w.stats.total_time);
+  EXPECT_EQ(20u, w.stats.max_time);
+  EXPECT_EQ(1u, w.stats.wakeups_ok);
+  EXPECT_EQ(1u, w.stats.wakeups_timeout);
+  EXPECT_EQ(0u, w.stats.wakeups_subthread);
+}
+
+TEST_F(StatsTest, TestWakeupLatency) {
+  Event event, other;
+  Worker &w = *new Worker(event);
+  w.cost[0] = w.cost[1] = w.cost[2] = 0;
+
+  kernel.lock();
+  kernel.schedule(w);
+  kernel.unlock();
+  run_all();
+  EXPECT_EQ(0u, w.latency.count());
+
+  // woken by the timer, and made to wait 3 cycles
+  port::run_as_interrupt(&stats_tick);
+  fake_cycles += 3;
+  run_all();
+  EXPECT_EQ(1u, w.latency.count());
+  EXPECT_EQ(1u, w.latency.bucket(1));
+
+  // woken by the event, and made to wait 300 cycles
+  kernel.lock();
+  kernel.signal_event(event, 0);
+  kernel.unlock();
+  fake_cycles += 300;
+  run_all();
+  EXPECT_EQ(2u, w.latency.count());
+  EXPECT_EQ(1u, w.latency.bucket(8));
+  EXPECT_EQ(1u, event.latency.count());
+  EXPECT_EQ(1u, event.latency.bucket(8));
+  EXPECT_EQ(0u, other.latency.count());
+
+  EXPECT_EQ(1u, w.latency.percentile(500));
+  EXPECT_EQ(8u, w.latency.percentile(990));
+
+  w.latency.reset();
+  EXPECT_EQ(0u, w.latency.count());
+}
+
+static Overrun hooked;
+static int hook_calls;
+
+static void overrun_hook(const Overrun &o) {
+  hooked = o;
+  hook_calls++;
+}
+
+TEST_F(StatsTest, TestRunBudget) {
+  Event event;
+  Worker &w = *new Worker(event);
+  kernel.set_run_budget(10);
+  kernel.set_overrun_hook(&overrun_hook);
+  hook_calls = 0;
+
+  kernel.lock();
+  kernel.schedule(w);
+  kernel.unlock();
+  run_all();
+  EXPECT_EQ(0u, kernel.overruns());
+  EXPECT_EQ((Thread *) 0, kernel.last_overrun().thread);
+
+  // the second run takes 20 cycles
+  port::run_as_interrupt(&stats_tick);
+  run_all();
+  EXPECT_EQ(1, hook_calls);
+  EXPECT_EQ(&w, hooked.thread);
+  EXPECT_EQ(10u, hooked.cycles);
+  EXPECT_STREQ(__FILE__, hooked.from_file);
+  EXPECT_LT(hooked.from_line, hooked.to_line);
+  EXPECT_EQ(w.debug_line, hooked.to_line);
+
+  // the thread's own budget wins over the kernel's
+  w.set_run_budget(6);
+  kernel.lock();
+  kernel.signal_event(event, 0);
+  kernel.unlock();
+  run_all();
+  EXPECT_EQ(2, hook_calls);
+  EXPECT_EQ(1u, hooked.cycles);
+  EXPECT_EQ(2u, w.stats.overruns);
+  EXPECT_EQ(2u, kernel.overruns());
+}
+
+TEST(LatencyHistogramTest, TestBuckets) {
+  LatencyHistogram h;
+  h.add(0);
+  h.add(1);
+  h.add(2);
+  h.add(3);
+  h.add(4);
+  h.add(0xffffffff);
+
+  EXPECT_EQ(2u, h.bucket(0));
+  EXPECT_EQ(2u, h.bucket(1));
+  EXPECT_EQ(1u, h.bucket(2));
+  EXPECT_EQ(1u, h.bucket(LatencyHistogram::BUCKETS - 1));
+  EXPECT_EQ(6u, h.count());
+  EXPECT_EQ((unsigned) LatencyHistogram::BUCKETS - 1, h.percentile(1000));
+}
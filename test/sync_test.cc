@@ -0,0 +1,897 @@
+#include <gtest/gtest.h>
+#include "ptk/kernel.h"
+#include "ptk/port.h"
+#include <string>
+
+using namespace ptk;
+
+// Test threads are leaked. Some are still waiting when the fixture's Kernel
+// goes away, and destroying them would need that kernel.
+
+struct SemTaker : public Thread {
+  Semaphore &sem;
+  ptk_time_t timeout;
+  int got, timeouts;
+
+  SemTaker(Semaphore &s, ptk_time_t t) :
+    sem(s), timeout(t), got(0), timeouts(0) {}
+
+  virtual void run() {
+    PTK_BEGIN();
+    PTK_SEM_WAIT(sem, timeout);
+    if (wakeup_reason == WAKEUP_OK) got++; else timeouts++;
+    PTK_END();
+  }
+};
+
+struct Locker : public Thread {
+  Mutex &mutex;
+  Event release;
+  ptk_time_t timeout;
+  int got, timeouts;
+
+  Locker(Mutex &m, priority_t p, ptk_time_t t = TIME_INFINITE) :
+    Thread(p), mutex(m), timeout(t), got(0), timeouts(0) {}
+
+  virtual void run() {
+    PTK_BEGIN();
+    PTK_MUTEX_LOCK(mutex, timeout);
+    if (wakeup_reason != WAKEUP_OK) {
+      timeouts++;
+    } else {
+      got++;
+      PTK_WAIT_EVENT(release, TIME_INFINITE);
+      PTK_MUTEX_UNLOCK(mutex);
+    }
+    PTK_END();
+  }
+};
+
+struct NestedLocker : public Thread {
+  Mutex &outer, &inner;
+
+  NestedLocker(Mutex &o, Mutex &i, priority_t p) :
+    Thread(p), outer(o), inner(i) {}
+
+  virtual void run() {
+    PTK_BEGIN();
+    PTK_MUTEX_LOCK(outer, TIME_INFINITE);
+    PTK_MUTEX_LOCK(inner, TIME_INFINITE);
+    PTK_MUTEX_UNLOCK(inner);
+    PTK_MUTEX_UNLOCK(outer);
+    PTK_END();
+  }
+};
+
+struct EventWaiter : public Thread {
+  Event &event;
+  wakeup_t reason;
+
+  EventWaiter(Event &e) : event(e), reason(0) {}
+
+  virtual void run() {
+    PTK_BEGIN();
+    PTK_WAIT_EVENT(event, 5);
+    reason = wakeup_reason;
+    PTK_END();
+  }
+};
+
+#if defined(PTK_LAZY_BROADCAST)
+static std::string arrivals;
+
+// marks the arrivals trail when its wait ends, whatever ended it, and
+// holds the mutex, if it has one, throughout
+struct Arriver : public Thread {
+  Event &event;
+  char mark;
+  Mutex *mutex;
+  wakeup_t reason;
+
+  Arriver(Event &e, char m, Mutex *mx = 0) : event(e), mark(m), mutex(mx), reason(0) {}
+
+  virtual void run() {
+    PTK_BEGIN();
+    if (mutex) {
+      PTK_MUTEX_LOCK(*mutex, TIME_INFINITE);
+    }
+    PTK_WAIT_EVENT(event, 5);
+    reason = wakeup_reason;
+    arrivals += mark;
+    if (mutex) {
+      PTK_MUTEX_UNLOCK(*mutex);
+    }
+    PTK_END();
+  }
+};
+#endif
+
+struct CondWaiter : public Thread {
+  Event &event;
+  volatile int &value;
+  int runs, timeout_reads;
+  bool done;
+
+  CondWaiter(Event &e, volatile int &v) :
+    event(e), value(v), runs(0), timeout_reads(0), done(false) {}
+
+  ptk_time_t timeout() {
+    timeout_reads++;
+    return 10;
+  }
+
+  virtual void run() {
+    runs++;
+    PTK_BEGIN();
+    PTK_WAIT_UNTIL_ON(event, value >= 3, timeout());
+    done = true;
+    PTK_END();
+  }
+};
+
+struct Stage : public SubThread {
+  Event go;
+  int starts;
+
+  Stage() : starts(0) {}
+
+  virtual void run() {
+    PTK_BEGIN();
+    starts++;
+    PTK_WAIT_EVENT(go, TIME_INFINITE);
+    PTK_END();
+  }
+};
+
+// forks the same subthreads again each time one of them finishes
+struct Reforker : public Thread {
+  Stage &a, &b, &c;
+  int rounds, joins;
+
+  Reforker(Stage &a, Stage &b, Stage &c, int n) :
+    a(a), b(b), c(c), rounds(n), joins(0) {}
+
+  virtual void run() {
+    PTK_BEGIN();
+    while (joins < rounds) {
+      PTK_WAIT_ANY(a, b, c, TIME_INFINITE);
+      joins++;
+    }
+    PTK_END();
+  }
+};
+
+struct Forker : public Thread {
+  Stage &a, &b, &c;
+  bool any;
+  ptk_time_t timeout;
+  wakeup_t reason;
+  Event after;
+
+  Forker(Stage &a, Stage &b, Stage &c, bool any, ptk_time_t t) :
+    a(a), b(b), c(c), any(any), timeout(t), reason(0) {}
+
+  virtual void run() {
+    PTK_BEGIN();
+    if (any) {
+      PTK_WAIT_ANY(a, b, c, timeout);
+    } else {
+      PTK_WAIT_ALL(a, b, c, timeout);
+    }
+    reason = wakeup_reason;
+    PTK_WAIT_EVENT(after, TIME_INFINITE);
+    PTK_END();
+  }
+};
+
+struct FlagWaiter : public Thread {
+  EventGroup &group;
+  uint32_t bits;
+  uint8_t options;
+  ptk_time_t timeout;
+  uint32_t seen;
+
+  FlagWaiter(EventGroup &g, uint32_t b, uint8_t o, ptk_time_t t) :
+    group(g), bits(b), options(o), timeout(t), seen(0) {}
+
+  virtual void run() {
+    PTK_BEGIN();
+    PTK_FLAGS_WAIT(group, bits, options, timeout);
+    seen = wait_flags();
+    PTK_END();
+  }
+};
+
+struct Selector : public Thread {
+  Event &a, &b, &c;
+  Event *got;
+
+  Selector(Event &x, Event &y, Event &z, priority_t p = PTK_DEFAULT_PRIORITY) :
+    Thread(p), a(x), b(y), c(z), got(0) {}
+
+  virtual void run() {
+    PTK_BEGIN();
+    PTK_WAIT_EVENTS({&a, &b, &c}, 5);
+    got = fired_event();
+    PTK_END();
+  }
+};
+
+static EventGroup *isr_group;
+static uint32_t isr_bits;
+
+static void set_flags_isr() {
+  enter_isr();
+  lock_from_isr();
+  flags_set(*isr_group, isr_bits);
+  unlock_from_isr();
+  leave_isr();
+}
+
+static void tick() {
+  enter_isr();
+  expire_timers(1);
+  leave_isr();
+}
+
+static Event *posted_event;
+static eventmask_t posted_mask;
+static bool post_locked;
+static uint32_t post_ticks;
+
+// posts, with or without the kernel lock, and then lets time pass
+static void post_isr() {
+  enter_isr();
+  if (post_locked) lock_from_isr();
+  post_event(*posted_event, posted_mask);
+  if (post_locked) unlock_from_isr();
+  if (post_ticks) expire_timers(post_ticks);
+  leave_isr();
+}
+
+class SyncTest : public ::testing::Test {
+protected:
+  Kernel kernel;
+
+  virtual void SetUp() {
+    the_kernel = &kernel;
+#if defined(PTK_LAZY_BROADCAST)
+    arrivals.clear();
+#endif
+  }
+
+  virtual void TearDown() { the_kernel = 0; }
+
+  void start(Thread &t) {
+    kernel.lock();
+    kernel.schedule(t);
+    kernel.unlock();
+    run_all();
+  }
+
+  void run_all() {
+    while (kernel.run_once()) ;
+  }
+
+  void ticks(int n) {
+    while (n--) port::run_as_interrupt(&tick);
+    run_all();
+  }
+
+  void signal(Semaphore &s) {
+    kernel.lock();
+    kernel.sem_signal(s);
+    kernel.unlock();
+    run_all();
+  }
+
+  void signal_event_now(Event &e) {
+    kernel.lock();
+    kernel.signal_event(e, 0);
+    kernel.unlock();
+    run_all();
+  }
+
+  // leaves the woken threads on the ready list, without running them
+  void broadcast(Event &e, eventmask_t mask) {
+    kernel.lock();
+    kernel.broadcast_event(e, mask);
+    kernel.unlock();
+  }
+
+  void set_flags(EventGroup &g, uint32_t bits) {
+    kernel.lock();
+    kernel.flags_set(g, bits);
+    kernel.unlock();
+    run_all();
+  }
+
+  void post(Event &e, eventmask_t mask, bool locked = false, uint32_t ticks = 0) {
+    posted_event = &e;
+    posted_mask = mask;
+    post_locked = locked;
+    post_ticks = ticks;
+    port::run_as_interrupt(&post_isr);
+  }
+
+  void release(Locker &l) {
+    kernel.lock();
+    kernel.signal_event(l.release, 0);
+    kernel.unlock();
+    run_all();
+  }
+};
+
+TEST_F(SyncTest, TestSemaphoreCounts) {
+  Semaphore sem(1);
+  SemTaker &a = *new SemTaker(sem, TIME_INFINITE);
+  SemTaker &b = *new SemTaker(sem, TIME_INFINITE);
+
+  start(a);
+  EXPECT_EQ(a.got, 1);
+  EXPECT_EQ(sem.value(), 0);
+
+  start(b);
+  EXPECT_EQ(b.got, 0);
+  EXPECT_EQ(b.state, WAIT_SEM_STATE);
+
+  signal(sem);
+  EXPECT_EQ(b.got, 1);
+  EXPECT_EQ(sem.value(), 0);
+}
+
+TEST_F(SyncTest, TestSemaphoreTimeout) {
+  Semaphore sem;
+  SemTaker &a = *new SemTaker(sem, 5);
+  SemTaker &b = *new SemTaker(sem, TIME_IMMEDIATE);
+
+  start(a);
+  ticks(4);
+  EXPECT_EQ(a.timeouts, 0);
+  ticks(1);
+  EXPECT_EQ(a.timeouts, 1);
+
+  // the timed out thread is off the wait list, so the unit is kept
+  signal(sem);
+  EXPECT_EQ(a.got, 0);
+  EXPECT_EQ(sem.value(), 1);
+
+  // polling takes it without blocking
+  start(b);
+  EXPECT_EQ(b.got, 1);
+}
+
+TEST_F(SyncTest, TestEventTimeoutLeavesWaitList) {
+  Event event;
+  EventWaiter &w = *new EventWaiter(event);
+
+  start(w);
+  ticks(5);
+  EXPECT_EQ(w.reason, WAKEUP_TIMEOUT);
+  EXPECT_EQ(w.state, FINAL_STATE);
+
+  // a signal to the now empty event mustn't schedule w again
+  kernel.lock();
+  kernel.signal_event(event, 1);
+  kernel.unlock();
+  EXPECT_FALSE(kernel.run_once());
+}
+
+TEST_F(SyncTest, TestMutexPriorityInheritance) {
+  Mutex mutex;
+  Locker &low = *new Locker(mutex, 1);
+  Locker &mid = *new Locker(mutex, 3);
+  Locker &high = *new Locker(mutex, 6);
+
+  start(low);
+  EXPECT_EQ(mutex.holder(), &low);
+
+  start(mid);
+  EXPECT_EQ(low.priority, 3);
+
+  start(high);
+  EXPECT_EQ(low.priority, 6);
+  EXPECT_EQ(mid.state, WAIT_MUTEX_STATE);
+
+  // the highest waiter gets it next, and inherits from the one left over
+  release(low);
+  EXPECT_EQ(low.priority, 1);
+  EXPECT_EQ(mutex.holder(), &high);
+  EXPECT_EQ(high.got, 1);
+
+  release(high);
+  EXPECT_EQ(mutex.holder(), &mid);
+  EXPECT_EQ(high.priority, 6);
+
+  release(mid);
+  EXPECT_EQ(mutex.holder(), (Thread *) 0);
+  EXPECT_EQ(mid.priority, 3);
+}
+
+TEST_F(SyncTest, TestMutexTimeoutDropsInheritance) {
+  Mutex mutex;
+  Locker &low = *new Locker(mutex, 1);
+  Locker &high = *new Locker(mutex, 6, 3);
+
+  start(low);
+  start(high);
+  EXPECT_EQ(low.priority, 6);
+
+  ticks(3);
+  EXPECT_EQ(high.timeouts, 1);
+  EXPECT_EQ(low.priority, 1);
+
+  release(low);
+  EXPECT_EQ(mutex.holder(), (Thread *) 0);
+}
+
+TEST_F(SyncTest, TestMutexChain) {
+  Mutex a, b;
+  Locker &low = *new Locker(a, 1);
+  NestedLocker &mid = *new NestedLocker(b, a, 2);
+  Locker &high = *new Locker(b, 5);
+
+  // low holds a, mid holds b and waits for a, high waits for b
+  start(low);
+  start(mid);
+  EXPECT_EQ(low.priority, 2);
+
+  start(high);
+  EXPECT_EQ(mid.priority, 5);
+  EXPECT_EQ(low.priority, 5);
+
+  release(low);
+  EXPECT_EQ(low.priority, 1);
+  EXPECT_EQ(mid.state, FINAL_STATE);
+  EXPECT_EQ(mid.priority, 2);
+  EXPECT_EQ(high.got, 1);
+}
+
+TEST_F(SyncTest, TestBroadcastBeatsTimeout) {
+  Event event;
+  EventWaiter &a = *new EventWaiter(event);
+  EventWaiter &b = *new EventWaiter(event);
+  EventWaiter &c = *new EventWaiter(event);
+
+  start(a);
+  start(b);
+  start(c);
+  kernel.lock();
+  kernel.broadcast_event(event, 4);
+  kernel.unlock();
+
+  // the timeouts fall due before the woken threads get to run
+  for (int i=0; i < 5; ++i) port::run_as_interrupt(&tick);
+  run_all();
+  EXPECT_EQ(a.reason & (WAKEUP_TIMEOUT | 4), 4);
+  EXPECT_EQ(b.reason & (WAKEUP_TIMEOUT | 4), 4);
+  EXPECT_EQ(c.reason & (WAKEUP_TIMEOUT | 4), 4);
+  EXPECT_EQ(c.state, FINAL_STATE);
+
+  kernel.lock();
+  kernel.signal_event(event, 1);
+  kernel.unlock();
+  EXPECT_FALSE(kernel.run_once());
+}
+
+TEST_F(SyncTest, TestPostFromCriticalSection) {
+  Event event;
+  EventWaiter &a = *new EventWaiter(event);
+  EventWaiter &b = *new EventWaiter(event);
+  start(a);
+
+  // a thread may post with the kernel locked, and the waiter still only
+  // wakes when the kernel takes the post
+  kernel.lock();
+  kernel.post_event(event, 4);
+  kernel.unlock();
+  EXPECT_EQ(a.state, WAIT_EVENT_STATE);
+  run_all();
+  EXPECT_EQ(a.reason & (WAKEUP_TIMEOUT | 4), 4);
+  EXPECT_EQ(a.state, FINAL_STATE);
+
+  // and so may a handler
+  start(b);
+  post(event, 8, true);
+  EXPECT_EQ(b.state, WAIT_EVENT_STATE);
+  run_all();
+  EXPECT_EQ(b.reason & (WAKEUP_TIMEOUT | 8), 8);
+}
+
+TEST_F(SyncTest, TestPostMergesWhilePending) {
+  Event event;
+  EventWaiter &a = *new EventWaiter(event);
+  EventWaiter &b = *new EventWaiter(event);
+  EventWaiter &c = *new EventWaiter(event);
+  start(a);
+  start(b);
+
+  // the second post finds the event queued, and adds its mask to the
+  // same broadcast rather than making another that nobody would get
+  post(event, 4);
+  post(event, 8);
+  run_all();
+  EXPECT_EQ(a.reason & (WAKEUP_TIMEOUT | 4 | 8), 4 | 8);
+  EXPECT_EQ(b.reason & (WAKEUP_TIMEOUT | 4 | 8), 4 | 8);
+
+  // once taken, the event can be posted again, with a fresh mask
+  start(c);
+  post(event, 16);
+  run_all();
+  EXPECT_EQ(c.reason & (WAKEUP_TIMEOUT | 4 | 8 | 16), 16);
+}
+
+TEST_F(SyncTest, TestPostRacesTimeout) {
+  Event event;
+  EventWaiter &a = *new EventWaiter(event);
+  EventWaiter &b = *new EventWaiter(event);
+
+  // the timeout falls due after the post, but before the kernel takes it
+  start(a);
+  for (int i=0; i < 4; ++i) port::run_as_interrupt(&tick);
+  post(event, 4, false, 1);
+  run_all();
+  EXPECT_EQ(a.reason & (WAKEUP_TIMEOUT | 4), WAKEUP_TIMEOUT);
+  EXPECT_EQ(a.state, FINAL_STATE);
+  EXPECT_FALSE(kernel.run_once());
+
+  // taken first, the post wins and the timer is gone
+  start(b);
+  for (int i=0; i < 4; ++i) port::run_as_interrupt(&tick);
+  post(event, 4);
+  run_all();
+  EXPECT_EQ(b.reason & (WAKEUP_TIMEOUT | 4), 4);
+  EXPECT_EQ(b.state, FINAL_STATE);
+  ticks(5);
+  EXPECT_FALSE(kernel.run_once());
+}
+
+TEST_F(SyncTest, TestWaitUntilOnOnlyRunsWhenSignaled) {
+  Event event;
+  volatile int value = 0;
+  CondWaiter &w = *new CondWaiter(event, value);
+
+  start(w);
+  EXPECT_EQ(w.runs, 1);
+  EXPECT_EQ(w.state, WAIT_EVENT_STATE);
+
+  for (int i=0; i < 2; ++i) {
+    value++;
+    kernel.lock();
+    kernel.broadcast_event(event, 0);
+    kernel.unlock();
+    run_all();
+  }
+  EXPECT_EQ(w.runs, 3);
+  EXPECT_FALSE(w.done);
+
+  value++;
+  kernel.lock();
+  kernel.broadcast_event(event, 0);
+  kernel.unlock();
+  run_all();
+  EXPECT_TRUE(w.done);
+  EXPECT_EQ(w.wakeup_reason, WAKEUP_OK);
+  EXPECT_EQ(w.runs, 4);
+
+  // the timeout is taken once, not on every pass
+  EXPECT_EQ(w.timeout_reads, 1);
+}
+
+TEST_F(SyncTest, TestWaitUntilOnTimesOut) {
+  Event event;
+  volatile int value = 0;
+  CondWaiter &w = *new CondWaiter(event, value);
+
+  start(w);
+  ticks(5);
+
+  // a signal doesn't restart the timeout
+  kernel.lock();
+  kernel.broadcast_event(event, 0);
+  kernel.unlock();
+  run_all();
+  ticks(4);
+  EXPECT_FALSE(w.done);
+
+  ticks(1);
+  EXPECT_TRUE(w.done);
+  EXPECT_EQ(w.wakeup_reason, WAKEUP_TIMEOUT);
+  EXPECT_EQ(w.runs, 3);
+  EXPECT_EQ(w.timeout_reads, 1);
+}
+
+TEST_F(SyncTest, TestWaitAll) {
+  Stage &a = *new Stage, &b = *new Stage, &c = *new Stage;
+  Forker &f = *new Forker(a, b, c, false, TIME_INFINITE);
+
+  start(f);
+  EXPECT_EQ(f.state, WAIT_SUBTHREAD_STATE);
+  EXPECT_EQ(a.state, WAIT_EVENT_STATE);
+  EXPECT_EQ(c.state, WAIT_EVENT_STATE);
+
+  signal_event_now(b.go);
+  signal_event_now(a.go);
+  EXPECT_EQ(b.state, FINAL_STATE);
+  EXPECT_EQ(f.state, WAIT_SUBTHREAD_STATE);
+
+  signal_event_now(c.go);
+  EXPECT_EQ(f.reason, WAKEUP_SUBTHREAD_DONE);
+  EXPECT_EQ(f.state, WAIT_EVENT_STATE);
+}
+
+TEST_F(SyncTest, TestWaitAny) {
+  Stage &a = *new Stage, &b = *new Stage, &c = *new Stage;
+  Forker &f = *new Forker(a, b, c, true, TIME_INFINITE);
+
+  start(f);
+  signal_event_now(b.go);
+  EXPECT_EQ(f.reason, WAKEUP_SUBTHREAD_DONE);
+  EXPECT_EQ(f.state, WAIT_EVENT_STATE);
+
+  // the others finish later without disturbing the parent's next wait
+  signal_event_now(a.go);
+  signal_event_now(c.go);
+  EXPECT_EQ(c.state, FINAL_STATE);
+  EXPECT_EQ(f.state, WAIT_EVENT_STATE);
+  EXPECT_FALSE(kernel.run_once());
+}
+
+TEST_F(SyncTest, TestWaitAnyForksAgain) {
+  Stage &a = *new Stage, &b = *new Stage, &c = *new Stage;
+  Reforker &f = *new Reforker(a, b, c, 2);
+
+  start(f);
+  EXPECT_EQ(b.starts, 1);
+
+  // the second fork takes b and c off go's wait list and starts them over
+  signal_event_now(a.go);
+  EXPECT_EQ(f.joins, 1);
+  EXPECT_EQ(a.starts, 2);
+  EXPECT_EQ(b.starts, 2);
+  EXPECT_EQ(c.starts, 2);
+  EXPECT_EQ(b.state, WAIT_EVENT_STATE);
+
+  signal_event_now(b.go);
+  EXPECT_EQ(f.joins, 2);
+  EXPECT_EQ(f.state, FINAL_STATE);
+
+  // each was on its wait list once
+  signal_event_now(b.go);
+  EXPECT_FALSE(kernel.run_once());
+  signal_event_now(a.go);
+  signal_event_now(c.go);
+  EXPECT_EQ(a.state, FINAL_STATE);
+  EXPECT_EQ(c.state, FINAL_STATE);
+  EXPECT_EQ(b.starts, 2);
+  EXPECT_FALSE(kernel.run_once());
+}
+
+TEST_F(SyncTest, TestWaitAllTimeout) {
+  Stage &a = *new Stage, &b = *new Stage, &c = *new Stage;
+  Forker &f = *new Forker(a, b, c, false, 5);
+
+  start(f);
+  signal_event_now(a.go);
+  ticks(5);
+  EXPECT_EQ(f.reason, WAKEUP_TIMEOUT);
+  EXPECT_EQ(f.state, WAIT_EVENT_STATE);
+
+  signal_event_now(b.go);
+  signal_event_now(c.go);
+  EXPECT_EQ(f.state, WAIT_EVENT_STATE);
+  EXPECT_FALSE(kernel.run_once());
+}
+
+TEST_F(SyncTest, TestFlagsAny) {
+  EventGroup group;
+  FlagWaiter &w = *new FlagWaiter(group, 0x3, FLAGS_ANY, TIME_INFINITE);
+
+  start(w);
+  EXPECT_EQ(w.state, WAIT_FLAGS_STATE);
+  set_flags(group, 0x4);
+  EXPECT_EQ(w.state, WAIT_FLAGS_STATE);
+
+  set_flags(group, 0x2);
+  EXPECT_EQ(w.state, FINAL_STATE);
+  EXPECT_EQ(w.wakeup_reason, WAKEUP_OK);
+  EXPECT_EQ(w.seen, 0x6u);
+  EXPECT_EQ(group.value(), 0x6u);
+}
+
+TEST_F(SyncTest, TestFlagsAllClear) {
+  EventGroup group(0x8);
+  FlagWaiter &a = *new FlagWaiter(group, 0x3, FLAGS_ALL | FLAGS_CLEAR, TIME_INFINITE);
+  FlagWaiter &b = *new FlagWaiter(group, 0x1, FLAGS_ANY, TIME_INFINITE);
+
+  start(a);
+  set_flags(group, 0x1);
+  EXPECT_EQ(a.state, WAIT_FLAGS_STATE);
+  EXPECT_EQ(group.value(), 0x9u);
+
+  // b sees the flags a clears, because both are checked against one value
+  start(b);
+  EXPECT_EQ(b.state, FINAL_STATE);
+  isr_group = &group;
+  isr_bits = 0x2;
+  port::run_as_interrupt(&set_flags_isr);
+  run_all();
+  EXPECT_EQ(a.state, FINAL_STATE);
+  EXPECT_EQ(a.seen, 0xbu);
+  EXPECT_EQ(group.value(), 0x8u);
+}
+
+TEST_F(SyncTest, TestFlagsTimeout) {
+  EventGroup group;
+  FlagWaiter &w = *new FlagWaiter(group, 0x1, FLAGS_ANY, 3);
+  FlagWaiter &poll = *new FlagWaiter(group, 0x1, FLAGS_ANY, TIME_IMMEDIATE);
+
+  start(poll);
+  EXPECT_EQ(poll.wakeup_reason, WAKEUP_TIMEOUT);
+  EXPECT_EQ(poll.state, FINAL_STATE);
+
+  start(w);
+  ticks(3);
+  EXPECT_EQ(w.wakeup_reason, WAKEUP_TIMEOUT);
+  EXPECT_EQ(w.state, FINAL_STATE);
+
+  // the timed out waiter is gone, so the bit stays set
+  set_flags(group, 0x1);
+  EXPECT_EQ(group.value(), 0x1u);
+  EXPECT_FALSE(kernel.run_once());
+}
+
+TEST_F(SyncTest, TestWaitEventsFirstFires) {
+  Event a, b, c;
+  Selector &s = *new Selector(a, b, c);
+  EventWaiter &w = *new EventWaiter(a);
+
+  start(s);
+  EXPECT_EQ(s.state, WAIT_EVENTS_STATE);
+  signal_event_now(b);
+  EXPECT_EQ(s.state, FINAL_STATE);
+  EXPECT_EQ(s.got, &b);
+
+  // the other registrations are gone, so a reaches the next waiter
+  start(w);
+  signal_event_now(a);
+  EXPECT_EQ(w.state, FINAL_STATE);
+  EXPECT_EQ(w.reason & WAKEUP_TIMEOUT, 0);
+  signal_event_now(c);
+  EXPECT_FALSE(kernel.run_once());
+}
+
+TEST_F(SyncTest, TestWaitEventsTimeout) {
+  Event a, b, c;
+  Selector &s = *new Selector(a, b, c);
+
+  start(s);
+  ticks(4);
+  EXPECT_EQ(s.state, WAIT_EVENTS_STATE);
+  ticks(1);
+  EXPECT_EQ(s.state, FINAL_STATE);
+  EXPECT_EQ(s.got, (Event *) 0);
+  EXPECT_EQ(s.wakeup_reason, WAKEUP_TIMEOUT);
+
+  kernel.lock();
+  kernel.broadcast_event(a, 1);
+  kernel.signal_event(c, 1);
+  kernel.unlock();
+  EXPECT_FALSE(kernel.run_once());
+}
+
+TEST_F(SyncTest, TestWaitEventsPriority) {
+  Event a, b, c;
+  EventWaiter &low = *new EventWaiter(c);
+  Selector &high = *new Selector(a, b, c, PTK_DEFAULT_PRIORITY + 1);
+  Selector &other = *new Selector(c, b, a);
+
+  start(low);
+  start(other);
+  start(high);
+
+  // a signal goes to the highest priority waiter, selecting or not
+  signal_event_now(c);
+  EXPECT_EQ(high.got, &c);
+  EXPECT_EQ(low.state, WAIT_EVENT_STATE);
+
+  // and a broadcast reaches both kinds
+  kernel.lock();
+  kernel.broadcast_event(c, 2);
+  kernel.unlock();
+  run_all();
+  EXPECT_EQ(other.got, &c);
+  EXPECT_EQ(other.wakeup_reason & 2, 2);
+  EXPECT_EQ(low.state, FINAL_STATE);
+}
+
+#if defined(PTK_LAZY_BROADCAST)
+// Waiters of one priority go to the ready list as a whole, still marked as
+// waiting, and each wakeup is finished later. These reach them in between.
+// Each event's destructor checks that no lazy wakeup was left unfinished.
+
+TEST_F(SyncTest, TestLazyBroadcastTimeout) {
+  Event event;
+  Arriver &a = *new Arriver(event, 'a');
+  Arriver &b = *new Arriver(event, 'b');
+  Arriver &c = *new Arriver(event, 'c');
+  start(a);
+  start(b);
+  start(c);
+
+  // the timeouts fire while the threads sit spliced onto the ready list
+  broadcast(event, 4);
+  for (int i=0; i < 5; ++i) port::run_as_interrupt(&tick);
+  EXPECT_EQ(a.state, WAIT_EVENT_STATE);
+
+  // each runs once, in order, woken by the broadcast alone
+  run_all();
+  EXPECT_EQ(arrivals, "abc");
+  EXPECT_EQ(a.reason & (WAKEUP_TIMEOUT | 4), 4);
+  EXPECT_EQ(b.reason & (WAKEUP_TIMEOUT | 4), 4);
+  EXPECT_EQ(c.reason & (WAKEUP_TIMEOUT | 4), 4);
+  EXPECT_EQ(c.state, FINAL_STATE);
+  EXPECT_FALSE(kernel.run_once());
+}
+
+TEST_F(SyncTest, TestLazyBroadcastSetPriority) {
+  Event event;
+  Mutex mutex;
+  Arriver &a = *new Arriver(event, 'a');
+  Arriver &b = *new Arriver(event, 'b');
+  Arriver &c = *new Arriver(event, 'c', &mutex);
+  Locker &high = *new Locker(mutex, PTK_DEFAULT_PRIORITY + 2);
+  start(a);
+  start(b);
+  start(c);
+  broadcast(event, 4);
+
+  // the locker runs first, and lends its priority to c while c is still
+  // spliced, which moves c to the ready list of its new level
+  kernel.lock();
+  kernel.schedule(high);
+  kernel.unlock();
+  EXPECT_TRUE(kernel.run_once());
+  EXPECT_EQ(c.priority, PTK_DEFAULT_PRIORITY + 2);
+  EXPECT_EQ(arrivals, "");
+
+  run_all();
+  EXPECT_EQ(arrivals, "cab");
+  EXPECT_EQ(high.got, 1);
+  EXPECT_EQ(c.priority, PTK_DEFAULT_PRIORITY);
+  EXPECT_EQ(a.reason & (WAKEUP_TIMEOUT | 4), 4);
+  EXPECT_EQ(b.reason & (WAKEUP_TIMEOUT | 4), 4);
+  EXPECT_EQ(c.reason & (WAKEUP_TIMEOUT | 4), 4);
+
+  // and the event's wait list is left empty
+  release(high);
+  ticks(5);
+  signal_event_now(event);
+  EXPECT_EQ(arrivals, "cab");
+  EXPECT_FALSE(kernel.run_once());
+}
+
+TEST_F(SyncTest, TestLazyBroadcastDestroy) {
+  Event event;
+  Arriver *a = new Arriver(event, 'a');
+  Arriver *b = new Arriver(event, 'b');
+  Arriver *c = new Arriver(event, 'c');
+  Arriver *d = new Arriver(event, 'd');
+  start(*a);
+  start(*b);
+  start(*c);
+  start(*d);
+
+  // from the head, the middle and the tail of the spliced run
+  broadcast(event, 4);
+  delete a;
+  delete c;
+  delete d;
+
+  run_all();
+  EXPECT_EQ(arrivals, "b");
+  EXPECT_EQ(b->state, FINAL_STATE);
+  ticks(5);
+  EXPECT_FALSE(kernel.run_once());
+}
+#endif
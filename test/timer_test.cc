@@ -0,0 +1,143 @@
+#include <gtest/gtest.h>
+#include "ptk/kernel.h"
+#include "ptk/port.h"
+
+using namespace ptk;
+
+// These go through the Kernel, so they cover whichever timer queue the
+// configuration selects.
+
+struct Alarm : public Timer {
+  uint64_t fired_at;
+  ptk_time_t late_by;
+  int fired;
+
+  Alarm() : fired_at(0), late_by(0), fired(0) {}
+
+  virtual void timer_expired() {
+    fired_at = now();
+    late_by = timer_expiration;
+    fired++;
+  }
+};
+
+static uint32_t alarm_ticks;
+
+static void alarm_tick() {
+  enter_isr();
+  expire_timers(alarm_ticks);
+  leave_isr();
+}
+
+class TimerTest : public ::testing::Test {
+protected:
+  Kernel kernel;
+
+  virtual void SetUp() { the_kernel = &kernel; }
+  virtual void TearDown() { the_kernel = 0; }
+
+  void ticks(uint32_t n, uint32_t step = 1) {
+    alarm_ticks = step;
+    for (uint32_t i=0; i < n; i += step) port::run_as_interrupt(&alarm_tick);
+  }
+
+  void arm(Alarm &a, ptk_time_t duration) {
+    kernel.lock();
+    kernel.arm_timer(a, duration);
+    kernel.unlock();
+  }
+
+  ptk_time_t deadline() {
+    kernel.lock();
+    ptk_time_t d = kernel.next_deadline();
+    kernel.unlock();
+    return d;
+  }
+};
+
+TEST_F(TimerTest, TestExpiresInDeadlineOrder) {
+  Alarm a[5];
+  const ptk_time_t durations[5] = { 7, 2, 9, 2, 4 };
+  for (int i=0; i < 5; ++i) arm(a[i], durations[i]);
+
+  ticks(10);
+  for (int i=0; i < 5; ++i) {
+    EXPECT_EQ(a[i].fired, 1);
+    EXPECT_EQ(a[i].fired_at, durations[i]);
+    EXPECT_EQ(a[i].late_by, 0u);
+  }
+}
+
+TEST_F(TimerTest, TestLateness) {
+  Alarm a, b;
+  arm(a, 3);
+  arm(b, 8);
+
+  // one jump past the first deadline, then one past the second
+  ticks(5, 5);
+  EXPECT_EQ(a.fired, 1);
+  EXPECT_EQ(a.late_by, 2u);
+  EXPECT_EQ(b.fired, 0);
+
+  ticks(10, 10);
+  EXPECT_EQ(b.fired, 1);
+  EXPECT_EQ(b.late_by, 7u);
+}
+
+TEST_F(TimerTest, TestNextDeadline) {
+  Alarm a, b;
+  EXPECT_EQ(deadline(), (ptk_time_t) TIME_INFINITE);
+
+  arm(a, 6);
+  arm(b, 3);
+  ticks(1);
+  EXPECT_EQ(deadline(), 2u);
+
+  ticks(2);
+  EXPECT_EQ(b.fired, 1);
+  EXPECT_EQ(deadline(), 3u);
+
+  ticks(3);
+  EXPECT_EQ(a.fired, 1);
+  EXPECT_EQ(deadline(), (ptk_time_t) TIME_INFINITE);
+}
+
+TEST_F(TimerTest, TestDisarmEarliest) {
+  Alarm a, b, c;
+  arm(a, 3);
+  arm(b, 10);
+  arm(c, 10);
+
+  // the queue must still find b and c once the earliest timer is gone
+  kernel.lock();
+  kernel.disarm_timer(a);
+  kernel.disarm_timer(c);
+  kernel.unlock();
+  ticks(3);
+  EXPECT_EQ(a.fired, 0);
+  EXPECT_EQ(deadline(), 7u);
+
+  ticks(6);
+  EXPECT_EQ(b.fired, 0);
+  ticks(1);
+  EXPECT_EQ(b.fired, 1);
+  EXPECT_EQ(c.fired, 0);
+}
+
+TEST_F(TimerTest, TestArmBehindEarliest) {
+  Alarm a, b;
+  arm(a, 20);
+  ticks(5);
+
+  // armed after, but due before, the timer already queued
+  arm(b, 2);
+  EXPECT_EQ(deadline(), 2u);
+  ticks(2);
+  EXPECT_EQ(b.fired, 1);
+  EXPECT_EQ(b.fired_at, 7u);
+  EXPECT_EQ(a.fired, 0);
+
+  ticks(13);
+  EXPECT_EQ(a.fired, 1);
+  EXPECT_EQ(a.fired_at, 20u);
+}
@@ -0,0 +1,134 @@
+#include <gtest/gtest.h>
+#include "ptk/timer.h"
+
+using namespace ptk;
+
+#if defined(PTK_TIMER_WHEEL)
+
+struct TestTimer : public Timer {
+  uint64_t deadline;
+  uint64_t fired_at;
+  ptk_time_t late_by;
+  bool armed;
+
+  TestTimer() : deadline(0), fired_at(0), late_by(0), armed(false) {}
+  virtual void timer_expired() {}
+  ptk_time_t expiration() const { return timer_expiration; }
+};
+
+class TimerWheelTest : public ::testing::Test {
+protected:
+  TimerWheel wheel;
+
+  // returns the number of timers that expired
+  int advance(ptk_time_t delta) {
+    TimerWheel::List expired;
+    wheel.advance(delta, expired);
+
+    int count = 0;
+    Timer *t;
+    while ((t = expired.pop())) {
+      TestTimer *tt = static_cast<TestTimer *>(t);
+      tt->fired_at = wheel.now();
+      tt->late_by = tt->expiration();
+      tt->armed = false;
+      count++;
+    }
+    return count;
+  }
+
+  void insert(TestTimer &t, ptk_time_t duration) {
+    t.deadline = wheel.now() + duration;
+    t.armed = true;
+    wheel.insert(t, duration);
+  }
+};
+
+TEST_F(TimerWheelTest, TestExpiresOnDeadline) {
+  TestTimer t;
+  insert(t, 5);
+
+  EXPECT_EQ(advance(4), 0);
+  EXPECT_EQ(advance(1), 1);
+  EXPECT_EQ(t.fired_at, 5u);
+  EXPECT_EQ(t.late_by, 0u);
+  EXPECT_EQ(advance(100), 0);
+}
+
+TEST_F(TimerWheelTest, TestZeroExpiresOnNextTick) {
+  TestTimer t;
+  insert(t, TIME_IMMEDIATE);
+
+  EXPECT_EQ(advance(0), 0);
+  EXPECT_EQ(advance(1), 1);
+  EXPECT_EQ(t.late_by, 1u);
+}
+
+TEST_F(TimerWheelTest, TestLargeJumpReportsLateness) {
+  TestTimer t;
+  insert(t, 1000);
+
+  EXPECT_EQ(advance(123456), 1);
+  EXPECT_EQ(t.late_by, 123456u - 1000u);
+}
+
+TEST_F(TimerWheelTest, TestRemove) {
+  TestTimer t1, t2;
+  insert(t1, 20);
+  insert(t2, 20);
+  wheel.remove(t1);
+  wheel.remove(t1);
+
+  EXPECT_EQ(advance(20), 1);
+  EXPECT_FALSE(t2.armed);
+  EXPECT_TRUE(t1.armed);
+}
+
+TEST_F(TimerWheelTest, TestLongestDuration) {
+  TestTimer t;
+  insert(t, TIME_INFINITE - 1);
+
+  EXPECT_EQ(advance(TIME_INFINITE - 2), 0);
+  EXPECT_EQ(advance(1), 1);
+  EXPECT_EQ(t.late_by, 0u);
+}
+
+TEST_F(TimerWheelTest, TestMatchesLinearScan) {
+  enum { N = 200 };
+  TestTimer timers[N];
+  uint32_t seed = 12345;
+
+  auto random = [&seed]() {
+    seed = seed * 1103515245 + 12345;
+    return seed >> 8;
+  };
+
+  for (int round=0; round < 2000; ++round) {
+    TestTimer &t = timers[random() % N];
+
+    if (t.armed) {
+      wheel.remove(t);
+      t.armed = false;
+    } else {
+      // mostly short durations, with the odd long one to exercise cascading
+      uint32_t r = random();
+      ptk_time_t duration = (r & 7) ? (r >> 3) % 300 : (r >> 3) % 70000;
+      insert(t, duration);
+    }
+
+    uint64_t before = wheel.now();
+    advance(random() % ((round & 15) ? 8 : 5000));
+
+    for (int i=0; i < N; ++i) {
+      if (timers[i].armed) {
+        EXPECT_TRUE(timers[i].deadline > wheel.now() ||
+                    (timers[i].deadline == before && before == wheel.now()));
+      } else if (timers[i].fired_at == wheel.now() && wheel.now() != before) {
+        EXPECT_LE(timers[i].deadline, wheel.now());
+        EXPECT_EQ(timers[i].late_by, wheel.now() - timers[i].deadline);
+      }
+    }
+  }
+}
+
+#endif // defined(PTK_TIMER_WHEEL)
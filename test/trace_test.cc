@@ -0,0 +1,89 @@
+#include <gtest/gtest.h>
+#include "ptk/kernel.h"
+
+using namespace ptk;
+
+// Test threads are leaked. Some are still waiting when the fixture's Kernel
+// goes away, and destroying them would need that kernel.
+
+struct Sleeper : public Thread {
+  virtual void run() {
+    PTK_BEGIN();
+    PTK_SLEEP(1);
+    PTK_END();
+  }
+};
+
+static void trace_tick() {
+  enter_isr();
+  expire_timers(1);
+  leave_isr();
+}
+
+class TraceTest : public ::testing::Test {
+protected:
+  Kernel kernel;
+
+  virtual void SetUp() { the_kernel = &kernel; }
+  virtual void TearDown() { the_kernel = 0; }
+
+  // index of the first record of the given kind at or after from, or -1
+  int find(trace::kind_t kind, const void *object, unsigned from = 0) {
+    trace::Buffer &buffer = kernel.trace_buffer();
+    for (unsigned i=from; i < buffer.count(); ++i) {
+      const trace::Record &r = buffer.get(i);
+      if (r.kind == kind && r.object == (uint32_t) (uintptr_t) object) return i;
+    }
+    return -1;
+  }
+};
+
+TEST_F(TraceTest, TestRingKeepsNewest) {
+  trace::Buffer buffer;
+  EXPECT_EQ(0u, buffer.count());
+
+  for (uint32_t i=0; i < trace::Buffer::RECORDS + 3; ++i) {
+    buffer.record(trace::WAKEUP, 0, i);
+  }
+
+  EXPECT_EQ((unsigned) trace::Buffer::RECORDS, buffer.count());
+  EXPECT_EQ(3u, buffer.get(0).arg);
+  EXPECT_EQ(trace::Buffer::RECORDS + 2u, buffer.get(buffer.count() - 1).arg);
+
+  buffer.enable(false);
+  buffer.record(trace::WAKEUP, 0, 99);
+  EXPECT_EQ(trace::Buffer::RECORDS + 2u, buffer.get(buffer.count() - 1).arg);
+
+  buffer.clear();
+  EXPECT_EQ(0u, buffer.count());
+}
+
+TEST_F(TraceTest, TestDispatchAndTimer) {
+  Sleeper &s = *new Sleeper;
+
+  kernel.lock();
+  kernel.schedule(s);
+  kernel.unlock();
+  kernel.trace_buffer().clear();
+
+  while (kernel.run_once()) ;
+  port::run_as_interrupt(&trace_tick);
+  while (kernel.run_once()) ;
+
+  int begin = find(trace::DISPATCH_BEGIN, &s);
+  int arm = find(trace::TIMER_ARM, &s);
+  int end = find(trace::DISPATCH_END, &s);
+  int expire = find(trace::TIMER_EXPIRE, &s);
+  int wakeup = find(trace::WAKEUP, &s);
+  int again = find(trace::DISPATCH_BEGIN, &s, end);
+
+  ASSERT_LE(0, begin);
+  EXPECT_LT(begin, arm);
+  EXPECT_LT(arm, end);
+  EXPECT_EQ((uint32_t) SLEEPING_STATE, kernel.trace_buffer().get(end).arg);
+  EXPECT_LT(end, expire);
+  EXPECT_LT(expire, wakeup);
+  EXPECT_EQ((uint32_t) WAKEUP_TIMEOUT, kernel.trace_buffer().get(wakeup).arg);
+  EXPECT_LT(wakeup, again);
+  EXPECT_EQ(FINAL_STATE, s.state);
+}
@@ -0,0 +1,4 @@
+#pragma once
+
+// The tools only need the trace record layout from libptk
+#define PTK_PORT_LINUX
@@ -0,0 +1,181 @@
+/*
+ * Converts the output of the "trace" shell command into Chrome trace JSON,
+ * which chrome://tracing and https://ui.perfetto.dev can open.
+ *
+ *   ptk_trace2json < capture.txt > trace.json
+ *
+ * The input may hold several dumps, for instance one per core of a
+ * PTK_MULTICORE build. Each becomes its own process in the output. Lines
+ * outside a dump, like shell prompts, are ignored.
+ *
+ * Every thread gets its own track, named by its address. Dispatches are
+ * slices on that track, and wakeups and timer events are instants on it.
+ * Interrupt handlers get a track of their own, and events share one.
+ */
+#include "ptk/trace.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+
+using namespace ptk;
+
+enum {
+  ISR_TRACK   = 1,
+  EVENT_TRACK = 2
+};
+
+static bool first_event = true;
+
+static void begin_event(const char *phase, const char *name, int pid,
+                        uint32_t tid, double usec)
+{
+  printf("%s\n  {\"ph\":\"%s\",\"name\":\"%s\",\"pid\":%d,\"tid\":%" PRIu32 ",\"ts\":%.3f",
+         first_event ? "" : ",", phase, name, pid, tid, usec);
+  first_event = false;
+}
+
+static void name_track(int pid, uint32_t tid, const char *name) {
+  printf("%s\n  {\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":%d,\"tid\":%" PRIu32
+         ",\"args\":{\"name\":\"%s\"}}",
+         first_event ? "" : ",", pid, tid, name);
+  first_event = false;
+}
+
+static void convert(int pid, double usec, unsigned kind, uint32_t object, uint32_t arg) {
+  char name[32];
+
+  switch (kind) {
+  case trace::DISPATCH_BEGIN :
+    begin_event("B", "run", pid, object, usec);
+    printf("}");
+    break;
+
+  case trace::DISPATCH_END :
+    begin_event("E", "run", pid, object, usec);
+    printf(",\"args\":{\"state\":%" PRIu32 "}}", arg);
+    break;
+
+  case trace::WAKEUP :
+    begin_event("i", "wakeup", pid, object, usec);
+    printf(",\"s\":\"t\",\"args\":{\"reason\":\"0x%" PRIx32 "\"}}", arg);
+    break;
+
+  case trace::TIMER_ARM :
+    begin_event("i", "timer armed", pid, object, usec);
+    printf(",\"s\":\"t\",\"args\":{\"ticks\":%" PRIu32 "}}", arg);
+    break;
+
+  case trace::TIMER_EXPIRE :
+    begin_event("i", "timer expired", pid, object, usec);
+    printf(",\"s\":\"t\",\"args\":{\"late\":%" PRIu32 "}}", arg);
+    break;
+
+  case trace::EVENT_SIGNAL :
+  case trace::EVENT_BROADCAST :
+  case trace::EVENT_POST :
+    snprintf(name, sizeof(name), "%s 0x%08" PRIx32,
+             kind == trace::EVENT_SIGNAL ? "signal" :
+             kind == trace::EVENT_BROADCAST ? "broadcast" : "post", object);
+    begin_event("i", name, pid, EVENT_TRACK, usec);
+    printf(",\"s\":\"t\",\"args\":{\"mask\":\"0x%" PRIx32 "\"}}", arg);
+    break;
+
+  case trace::ISR_ENTER :
+    begin_event("B", "isr", pid, ISR_TRACK, usec);
+    printf(",\"args\":{\"depth\":%" PRIu32 "}}", arg);
+    break;
+
+  case trace::ISR_LEAVE :
+    begin_event("E", "isr", pid, ISR_TRACK, usec);
+    printf("}");
+    break;
+
+  case trace::RUN_OVERRUN :
+    begin_event("i", "over budget", pid, object, usec);
+    printf(",\"s\":\"t\",\"args\":{\"cycles\":%" PRIu32 "}}", arg);
+    break;
+
+  default :
+    fprintf(stderr, "unknown record kind %u\n", kind);
+    break;
+  }
+}
+
+int main() {
+  char line[256];
+  int pid = 0;
+  unsigned remaining = 0;
+  double usec_per_tick = 0;
+  uint32_t last = 0;
+  bool first_record = false;
+  double usec = 0;
+
+  // track names are only known once the threads show up
+  enum { MAX_TRACKS = 256 };
+  uint32_t named[MAX_TRACKS];
+  unsigned named_count = 0;
+
+  printf("{\"traceEvents\":[");
+
+  while (fgets(line, sizeof(line), stdin)) {
+    const char *header = strstr(line, "ptk-trace ");
+    unsigned version, hz, count;
+
+    if (header && sscanf(header, "ptk-trace %u %u %u", &version, &hz, &count) == 3) {
+      if (version != trace::VERSION) {
+        fprintf(stderr, "unsupported trace version %u\n", version);
+        return 1;
+      }
+
+      pid++;
+      remaining = count;
+      usec_per_tick = 1e6 / hz;
+      usec = 0;
+      first_record = true;
+      named_count = 0;
+
+      char name[32];
+      snprintf(name, sizeof(name), "ptk %d", pid);
+      printf("%s\n  {\"ph\":\"M\",\"name\":\"process_name\",\"pid\":%d,\"args\":{\"name\":\"%s\"}}",
+             first_event ? "" : ",", pid, name);
+      first_event = false;
+      name_track(pid, ISR_TRACK, "interrupts");
+      name_track(pid, EVENT_TRACK, "events");
+      continue;
+    }
+
+    unsigned kind;
+    uint32_t timestamp, object, arg;
+    if (remaining == 0 ||
+        sscanf(line, "%x %" SCNx32 " %" SCNx32 " %" SCNx32, &kind, &timestamp, &object, &arg) != 4) {
+      continue;
+    }
+
+    // the timestamp wraps, so accumulate the differences
+    if (first_record) last = timestamp;
+    first_record = false;
+    usec += (uint32_t) (timestamp - last) * usec_per_tick;
+    last = timestamp;
+    remaining--;
+
+    bool thread_track = (kind == trace::DISPATCH_BEGIN || kind == trace::DISPATCH_END ||
+                         kind == trace::WAKEUP || kind == trace::TIMER_ARM ||
+                         kind == trace::TIMER_EXPIRE);
+    if (thread_track) {
+      bool known = false;
+      for (unsigned i=0; i < named_count && !known; ++i) known = (named[i] == object);
+      if (!known && named_count < MAX_TRACKS) {
+        char name[32];
+        snprintf(name, sizeof(name), "thread 0x%08" PRIx32, object);
+        name_track(pid, object, name);
+        named[named_count++] = object;
+      }
+    }
+
+    convert(pid, usec, kind, object, arg);
+  }
+
+  printf("\n]}\n");
+  return 0;
+}